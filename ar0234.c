@@ -10,20 +10,38 @@
  *
  */
 
+#include <linux/atomic.h>
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/firmware.h>
 #include <linux/gpio/consumer.h>
+#include <linux/interrupt.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
 #include <linux/module.h>
 #include <linux/of.h>
 #include <linux/pm_runtime.h>
+#include <linux/regmap.h>
 #include <linux/regulator/consumer.h>
-
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/unaligned.h>
+#include <linux/workqueue.h>
+
+#include <media/mipi-csi2.h>
 #include <media/v4l2-cci.h>
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-event.h>
 #include <media/v4l2-fwnode.h>
 #include <media/v4l2-subdev.h>
 
+#define CREATE_TRACE_POINTS
+#include "ar0234_trace.h"
+
 static int trigger_mode;
 module_param(trigger_mode, int, 0644);
 MODULE_PARM_DESC(trigger_mode,
@@ -36,7 +54,11 @@ MODULE_PARM_DESC(trigger_mode,
 #define AR0234_REG_Y_ADDR_END CCI_REG16(0x3006)
 #define AR0234_REG_X_ADDR_END CCI_REG16(0x3008)
 #define AR0234_REG_FRAME_LENGTH_LINES CCI_REG16(0x300A)
+#define AR0234_REG_LINE_LENGTH_PCK CCI_REG16(0x300C)
 #define AR0234_REG_EXPOSURE_COARSE CCI_REG16(0x3012)
+#define AR0234_REG_EXPOSURE_FINE CCI_REG16(0x3014)
+#define AR0234_REG_EXPOSURE_COARSE_CB CCI_REG16(0x3016)
+#define AR0234_REG_EXPOSURE_FINE_CB CCI_REG16(0x3018)
 #define AR0234_REG_RESET CCI_REG16(0x301A)
 #define AR0234_REG_MODE_SELECT CCI_REG8(0x301C)
 #define AR0234_REG_IMAGE_ORIENTATION CCI_REG8(0x301D)
@@ -47,6 +69,7 @@ MODULE_PARM_DESC(trigger_mode,
 #define AR0234_REG_PLL_MULTIPLIER CCI_REG16(0x3030)
 #define AR0234_REG_OP_PIX_CLK_DIV CCI_REG16(0x3036)
 #define AR0234_REG_OP_SYS_CLK_DIV CCI_REG16(0x3038)
+#define AR0234_REG_FRAME_COUNT CCI_REG16(0x303A)
 #define AR0234_REG_READ_MODE CCI_REG16(0x3040)
 #define AR0234_REG_DIGITAL_GAIN CCI_REG16(0x305E)
 #define AR0234_REG_ANALOG_GAIN CCI_REG16(0x3060)
@@ -60,11 +83,21 @@ MODULE_PARM_DESC(trigger_mode,
 #define AR0234_REG_OPERATION_MODE_CTRL CCI_REG16(0x3082)
 #define AR0234_REG_SEQ_DATA_PORT CCI_REG16(0x3086)
 #define AR0234_REG_SEQ_CTRL_PORT CCI_REG16(0x3088)
+#define AR0234_REG_X_ADDR_START_CB CCI_REG16(0x308A)
+#define AR0234_REG_Y_ADDR_START_CB CCI_REG16(0x308C)
+#define AR0234_REG_X_ADDR_END_CB CCI_REG16(0x308E)
+#define AR0234_REG_Y_ADDR_END_CB CCI_REG16(0x3090)
 #define AR0234_REG_X_ODD_INC CCI_REG16(0x30A2)
 #define AR0234_REG_Y_ODD_INC CCI_REG16(0x30A6)
+#define AR0234_REG_Y_ODD_INC_CB CCI_REG16(0x30A8)
+#define AR0234_REG_FRAME_LENGTH_LINES_CB CCI_REG16(0x30AA)
+#define AR0234_REG_X_ODD_INC_CB CCI_REG16(0x30AE)
 #define AR0234_REG_DIGITAL_TEST CCI_REG16(0x30B0)
+#define AR0234_REG_TEMPSENS_DATA CCI_REG16(0x30B2)
 #define AR0234_REG_TEMPSENS_CTRL CCI_REG16(0x30B4)
 #define AR0234_REG_MFR_30BA CCI_REG16(0x30BA)
+#define AR0234_REG_TEMPSENS_CALIB1 CCI_REG16(0x30C6)
+#define AR0234_REG_TEMPSENS_CALIB2 CCI_REG16(0x30C8)
 #define AR0234_REG_GRR_CONTROL1 CCI_REG16(0x30CE)
 #define AR0234_REG_AE_LUMA_TARGET CCI_REG16(0x3102)
 #define AR0234_REG_DELTA_DK_CONTROL CCI_REG16(0x3180)
@@ -86,10 +119,22 @@ MODULE_PARM_DESC(trigger_mode,
 #define AR0234_CHIP_ID 0x0A56
 #define AR0234_CHIP_ID_MONO 0x1A56
 
-/* Sensor frequencies */
+/* Sensor frequencies, the built-in PLL configs are for a 24MHz EXTCLK */
 #define AR0234_FREQ_EXTCLK 24000000
 #define AR0234_FREQ_PIXCLK_45MHZ 45000000
 #define AR0234_FREQ_PIXCLK_90MHZ 90000000
+#define AR0234_FREQ_VT_PIX_CLK 90000000
+
+/* PLL limits for dividers computed for other EXTCLK rates */
+#define AR0234_PLL_IN_MIN 2000000
+#define AR0234_PLL_IN_MAX 24000000
+#define AR0234_PLL_VCO_MIN 384000000ULL
+#define AR0234_PLL_VCO_MAX 1000000000ULL
+#define AR0234_PRE_PLL_CLK_DIV_MAX 64
+#define AR0234_PLL_MULTIPLIER_MIN 20
+#define AR0234_PLL_MULTIPLIER_MAX 384
+#define AR0234_VT_PIX_CLK_DIV_MAX 16
+#define AR0234_OP_SYS_CLK_DIV_MAX 2
 
 /*
  * AR0234 uses different link frequencies depending on
@@ -103,6 +148,11 @@ MODULE_PARM_DESC(trigger_mode,
 #define AR0234_FLL_MAX (0xFFFF + AR0234_FLL_OVERHEAD)
 #define AR0234_VBLANK_MIN (16 + AR0234_FLL_OVERHEAD)
 #define AR0234_LINE_LENGTH_PCK_DEF 612
+#define AR0234_LINE_LENGTH_PCK_MAX 0xFFFF
+/* Horizontal blanking needed on top of the line data on the MIPI link */
+#define AR0234_LINE_BLANKING_MIN 132
+/* Pixels read out per pixel clock cycle without binning */
+#define AR0234_PIXELS_PER_CLK 4
 
 /* AR0234_REG_RESET Bits */
 #define AR0234_RESET_DEFAULT 0x2058
@@ -110,15 +160,31 @@ MODULE_PARM_DESC(trigger_mode,
 #define AR0234_RESET_GPI_EN BIT(8)
 #define AR0234_RESET_FORCED_PLL_ON BIT(11)
 
+/* AR0234_REG_READ_MODE Bits */
+#define AR0234_READ_MODE_ROW_BIN BIT(13)
+#define AR0234_READ_MODE_COL_BIN BIT(12)
+#define AR0234_READ_MODE_BINNING \
+	(AR0234_READ_MODE_ROW_BIN | AR0234_READ_MODE_COL_BIN)
+
+/* AR0234_REG_DIGITAL_TEST Bits */
+#define AR0234_DIGITAL_TEST_CONTEXT_B BIT(13)
+
+/* AR0234_REG_SMIA_TEST Bits */
+#define AR0234_SMIA_TEST_EMBEDDED_STATS BIT(7)
+#define AR0234_SMIA_TEST_EMBEDDED_DATA BIT(8)
+
 /* AR0234_REG_GRR_CONTROL1 Bits */
 #define AR0234_GRR_SLAVE_SH_SYNC BIT(8)
 
 /* AR0234_REG_LED_FLASH_CONTROL Bits */
 #define AR0234_FLASH_ENABLE BIT(8)
+#define AR0234_FLASH_INVERT BIT(9)
 
 /* Exposure control */
 #define AR0234_EXPOSURE_MIN 2
 #define AR0234_EXPOSURE_STEP 1
+/* Longest exposure, in lines, with VBLANK at its maximum */
+#define AR0234_EXPOSURE_MAX (AR0234_FLL_MAX - AR0234_FLL_OVERHEAD - 1)
 
 /* Analog gain control */
 #define AR0234_ANA_GAIN_MIN 0x0D
@@ -145,8 +211,62 @@ MODULE_PARM_DESC(trigger_mode,
 #define AR0234_TEST_PATTERN_FADE_TO_GREY 3
 #define AR0234_TEST_PATTERN_WALKING_1S 256
 
+/* Driver specific controls */
+#define V4L2_CID_AR0234_BASE (V4L2_CID_USER_BASE + 0x3000)
+#define V4L2_CID_AR0234_CONTEXT (V4L2_CID_AR0234_BASE + 0)
+#define V4L2_CID_AR0234_CONTEXT_B_MODE (V4L2_CID_AR0234_BASE + 1)
+#define V4L2_CID_AR0234_TRIGGER_MODE (V4L2_CID_AR0234_BASE + 2)
+#define V4L2_CID_AR0234_TRIGGER_LATENCY (V4L2_CID_AR0234_BASE + 3)
+#define V4L2_CID_AR0234_SOFTWARE_TRIGGER (V4L2_CID_AR0234_BASE + 4)
+#define V4L2_CID_AR0234_SYNC_GROUP (V4L2_CID_AR0234_BASE + 5)
+#define V4L2_CID_AR0234_SYNC_STREAM_ON_SKEW (V4L2_CID_AR0234_BASE + 6)
+#define V4L2_CID_AR0234_FLASH_ENABLE (V4L2_CID_AR0234_BASE + 7)
+#define V4L2_CID_AR0234_FLASH_DELAY (V4L2_CID_AR0234_BASE + 8)
+#define V4L2_CID_AR0234_FLASH_POLARITY (V4L2_CID_AR0234_BASE + 9)
+#define V4L2_CID_AR0234_TEMPERATURE (V4L2_CID_AR0234_BASE + 10)
+#define V4L2_CID_AR0234_GROUP_HOLD (V4L2_CID_AR0234_BASE + 11)
+#define V4L2_CID_AR0234_EXPOSURE_DELAY (V4L2_CID_AR0234_BASE + 12)
+#define V4L2_CID_AR0234_GAIN_DELAY (V4L2_CID_AR0234_BASE + 13)
+#define V4L2_CID_AR0234_VBLANK_DELAY (V4L2_CID_AR0234_BASE + 14)
+#define V4L2_CID_AR0234_EXPOSURE_FINE (V4L2_CID_AR0234_BASE + 15)
+#define V4L2_CID_AR0234_EXPOSURE_US (V4L2_CID_AR0234_BASE + 16)
+
+/* Flash delay in LED_FLASH_CONTROL units, negative leads the exposure */
+#define AR0234_FLASH_DELAY_MAX 127
+
+/*
+ * Temperature sensor, TEMPSENS_CALIB1 and TEMPSENS_CALIB2 hold the factory
+ * readings at 55 and 70 degrees Celsius. Reported in millidegrees.
+ */
+#define AR0234_TEMPSENS_DATA_MASK GENMASK(10, 0)
+#define AR0234_TEMP_CALIB1_MC 55000
+#define AR0234_TEMP_CALIB2_MC 70000
+#define AR0234_TEMP_MIN_MC (-40000)
+#define AR0234_TEMP_MAX_MC 125000
+#define AR0234_TEMP_POLL_MS 1000
+
+/*
+ * Frames between the frame start a grouped hold is released on and the
+ * first frame showing the new value. Integration of a frame overlaps the
+ * readout of the previous one, gains are applied at readout.
+ */
+#define AR0234_EXPOSURE_DELAY 2
+#define AR0234_GAIN_DELAY 1
+#define AR0234_VBLANK_DELAY 2
+
+/* Frame sync events queued per subscriber */
+#define AR0234_NUM_FRAME_SYNC_EVENTS 2
+
+/* Sync group IDs, 0 is no group */
+#define AR0234_SYNC_GROUP_MAX 255
+
+/* Sensor register contexts */
+#define AR0234_CONTEXT_A 0
+#define AR0234_CONTEXT_B 1
+
 /* Trigger modes */
 #define AR0234_TRIGGER_MODE_OFF 0
+#define AR0234_TRIGGER_MODE_EXTERNAL 1
 #define AR0234_TRIGGER_MODE_SLAVE_SYNC 2
 
 /* Native and active pixel array sizes */
@@ -157,21 +277,46 @@ MODULE_PARM_DESC(trigger_mode,
 #define AR0234_PIXEL_ARRAY_WIDTH 1920U
 #define AR0234_PIXEL_ARRAY_HEIGHT 1200U
 
-/* Embedded metadata stream buffer size (padding every 4 bytes) */
-#define AR0234_MD_PADDING_BYTES (AR0234_PIXEL_ARRAY_WIDTH / 4)
-#define AR0234_EMBEDDED_LINE_WIDTH \
-	(AR0234_PIXEL_ARRAY_WIDTH + AR0234_MD_PADDING_BYTES)
+/* Crop rectangle limits */
+#define AR0234_CROP_MIN_WIDTH 64U
+#define AR0234_CROP_MIN_HEIGHT 8U
+#define AR0234_CROP_WIDTH_ALIGN 8U
+#define AR0234_CROP_HEIGHT_ALIGN 2U
+
+/* First readable column and row in X/Y_ADDR_START/END coordinates */
+#define AR0234_ADDR_START_MIN 8U
+
+/*
+ * Embedded metadata stream: register data lines before and statistics lines
+ * after the image, packed like the image data. Sized for a full width line.
+ */
 #define AR0234_NUM_EMBEDDED_LINES 2
+#define AR0234_NUM_STATS_LINES 2
+#define AR0234_NUM_METADATA_LINES \
+	(AR0234_NUM_EMBEDDED_LINES + AR0234_NUM_STATS_LINES)
+
+/* Internal initialization after a hard or soft reset, in EXTCLK cycles */
+#define AR0234_RESET_DELAY_CYCLES 160000
 
-/* RESET GPIO */
-#define AR0234_RESET_DELAY_MIN_US 6200
-#define AR0234_RESET_DELAY_RANGE_US 1000
+/* Default runtime PM autosuspend delay */
+#define AR0234_AUTOSUSPEND_DELAY_MS 1000
 
 /* Register address size in bits */
 #define AR0234_REG_ADDRESS_BITS 16
+#define AR0234_REG_ADDRESS_MAX 0x3FFF
 
-/* 1 format code for selected link frequency */
-#define AR0234_NUM_FMT_CODES 1
+/* Longest auto-increment register burst, in data bytes */
+#define AR0234_BURST_MAX_BYTES 32
+
+/* Registers per debugfs bulk access, and debugfs writes kept for replay */
+#define AR0234_DEBUGFS_REGS_MAX 128
+#define AR0234_REG_PATCH_MAX 64
+
+/* Self-test frame rate measurement time, and longest wait for a frame */
+#define AR0234_SELFTEST_MEASURE_MS 500
+#define AR0234_SELFTEST_FRAME_TIMEOUT_MS 500
+/* Vertical Color Bars, in ar0234_test_pattern_menu */
+#define AR0234_SELFTEST_TEST_PATTERN 2
 
 #define AR0234_NUM_SUPPLIES ARRAY_SIZE(ar0234_supply_names)
 
@@ -203,6 +348,9 @@ struct ar0234_mode {
 	struct ar0234_reg_sequence reg_sequence;
 };
 
+/* Window, sub-sampling and READ_MODE registers of a mode */
+#define AR0234_MODE_NUM_REGS 7
+
 /*
  * PLL config for:
  * External clock - 24MHz
@@ -266,11 +414,11 @@ static const struct cci_reg_sequence common_init[] = {
 	{ CCI_REG16(0x3ED2), 0xFA96 },
 	{ AR0234_REG_DELTA_DK_CONTROL, 0x824F },
 	{ CCI_REG16(0x3ECC), 0x0C42 },
-	{ CCI_REG16(0x3ECC), 0x0C42 },
 	{ CCI_REG16(0x30F0), 0x2283 },
 	{ AR0234_REG_AE_LUMA_TARGET, 0x5000 },
 	{ AR0234_REG_TEMPSENS_CTRL, 0x0011 },
-	{ AR0234_REG_SMIA_TEST, 0x1982 },
+	/* Embedded data and statistics lines follow the metadata stream */
+	{ AR0234_REG_SMIA_TEST, 0x1802 },
 };
 
 /* Recommended manufacturer settings for 45MHz pixel clock */
@@ -279,43 +427,71 @@ static const struct cci_reg_sequence pixclk_45mhz_mfr_settings[] = {
 	{ AR0234_REG_SEQ_DATA_PORT, 0x3D02 },
 };
 
-/* Full sensor resolution */
-static const struct cci_reg_sequence ar0234_1920x1200_config[] = {
-	{ AR0234_REG_Y_ADDR_START, 0x0008 },
-	{ AR0234_REG_X_ADDR_START, 0x0008 },
-	{ AR0234_REG_Y_ADDR_END, 0x04B7 },
-	{ AR0234_REG_X_ADDR_END, 0x0787 },
-	{ AR0234_REG_X_ODD_INC, 0x0001 },
-	{ AR0234_REG_Y_ODD_INC, 0x0001 },
+/*
+ * Generated modes: a window centered on the pixel array, read out with every
+ * x_inc-th column and y_inc-th row. The skipped lines of a sub-sampled axis
+ * are either binned (2x only) or dropped. Output sizes keep the crop
+ * alignment, so windows are multiples of 8 * x_inc by 2 * y_inc.
+ */
+struct ar0234_mode_desc {
+	u16 crop_width;
+	u16 crop_height;
+	u8 x_inc;
+	u8 y_inc;
+	bool bin;
+};
+
+/* Context B default, the first binned mode */
+#define AR0234_MODE_BINNED_PREVIEW 3
+
+static const struct ar0234_mode_desc ar0234_mode_descs[] = {
+	/* Full resolution and crops */
+	{ 1920, 1200, 1, 1, false },
+	{ 1920, 1080, 1, 1, false },
+	{ 1280, 720, 1, 1, false },
+	/* 2x2 binned */
+	{ 1920, 1200, 2, 2, true },
+	{ 1920, 1080, 2, 2, true },
+	{ 1280, 720, 2, 2, true },
+	/* 4x4 skipped */
+	{ 1920, 1200, 4, 4, false },
+	{ 1920, 1080, 4, 4, false },
+	/* Horizontal or vertical only */
+	{ 1920, 1200, 2, 1, true },
+	{ 1920, 1200, 1, 2, true },
+	{ 1920, 1200, 1, 4, false },
+};
+
+/*
+ * Context B copies of context A registers, sorted by context B address so
+ * that the preloaded frame geometry goes out in one burst.
+ */
+struct ar0234_context_reg {
+	u32 reg_a;
+	u32 reg_b;
 };
 
-static const struct cci_reg_sequence ar0234_1080p_config[] = {
-	{ AR0234_REG_Y_ADDR_START, 0x0044 },
-	{ AR0234_REG_X_ADDR_START, 0x0008 },
-	{ AR0234_REG_Y_ADDR_END, 0x047B },
-	{ AR0234_REG_X_ADDR_END, 0x0787 },
-	{ AR0234_REG_X_ODD_INC, 0x0001 },
-	{ AR0234_REG_Y_ODD_INC, 0x0001 },
+static const struct ar0234_context_reg ar0234_context_regs[] = {
+	{ AR0234_REG_EXPOSURE_COARSE, AR0234_REG_EXPOSURE_COARSE_CB },
+	{ AR0234_REG_EXPOSURE_FINE, AR0234_REG_EXPOSURE_FINE_CB },
+	{ AR0234_REG_X_ADDR_START, AR0234_REG_X_ADDR_START_CB },
+	{ AR0234_REG_Y_ADDR_START, AR0234_REG_Y_ADDR_START_CB },
+	{ AR0234_REG_X_ADDR_END, AR0234_REG_X_ADDR_END_CB },
+	{ AR0234_REG_Y_ADDR_END, AR0234_REG_Y_ADDR_END_CB },
+	{ AR0234_REG_Y_ODD_INC, AR0234_REG_Y_ODD_INC_CB },
+	{ AR0234_REG_FRAME_LENGTH_LINES, AR0234_REG_FRAME_LENGTH_LINES_CB },
+	{ AR0234_REG_X_ODD_INC, AR0234_REG_X_ODD_INC_CB },
 };
 
-static const struct cci_reg_sequence ar0234_720p_config[] = {
-	{ AR0234_REG_Y_ADDR_START, 0x00F8 },
-	{ AR0234_REG_X_ADDR_START, 0x0148 },
-	{ AR0234_REG_Y_ADDR_END, 0x03C7 },
-	{ AR0234_REG_X_ADDR_END, 0x0647 },
-	{ AR0234_REG_X_ODD_INC, 0x0001 },
-	{ AR0234_REG_Y_ODD_INC, 0x0001 },
+static const char *const ar0234_context_menu[] = {
+	"Context A",
+	"Context B",
 };
 
-/* Binned 2x2 */
-static const struct cci_reg_sequence ar0234_960x600_config[] = {
-	{ AR0234_REG_Y_ADDR_START, 0x0008 },
-	{ AR0234_REG_X_ADDR_START, 0x0008 },
-	{ AR0234_REG_Y_ADDR_END, 0x04B7 },
-	{ AR0234_REG_X_ADDR_END, 0x0787 },
-	{ AR0234_REG_X_ODD_INC, 0x0003 },
-	{ AR0234_REG_Y_ODD_INC, 0x0003 },
-	{ AR0234_REG_READ_MODE, 0x3000 },
+static const char *const ar0234_trigger_mode_menu[] = {
+	[AR0234_TRIGGER_MODE_OFF] = "Off",
+	[AR0234_TRIGGER_MODE_EXTERNAL] = "External Trigger",
+	[AR0234_TRIGGER_MODE_SLAVE_SYNC] = "Sync Sink",
 };
 
 static const char *const ar0234_test_pattern_menu[] = {
@@ -342,64 +518,39 @@ static const char *const ar0234_supply_names[] = {
 	"vddl", /* IF (1.2V) supply */
 };
 
-/* Format configs */
-static const struct ar0234_mode ar0234_modes[] = {
-	{
-		.width = 1920,
-		.height = 1200,
-		.crop = {
-			.left = AR0234_PIXEL_ARRAY_LEFT,
-			.top = AR0234_PIXEL_ARRAY_TOP,
-			.width = 1920,
-			.height = 1200,
-		},
-		.reg_sequence = {
-			.regs = ar0234_1920x1200_config,
-			.num_regs = ARRAY_SIZE(ar0234_1920x1200_config),
-		},
-	},
-	{
-		.width = 1920,
-		.height = 1080,
-		.crop = {
-			.left = AR0234_PIXEL_ARRAY_LEFT + 60,
-			.top = AR0234_PIXEL_ARRAY_TOP,
-			.width = 1920,
-			.height = 1080,
-		},
-		.reg_sequence = {
-			.regs = ar0234_1080p_config,
-			.num_regs = ARRAY_SIZE(ar0234_1080p_config),
-		},
-	},
-	{
-		.width = 1280,
-		.height = 720,
-		.crop = {
-			.left = AR0234_PIXEL_ARRAY_LEFT + 320,
-			.top = AR0234_PIXEL_ARRAY_TOP + 240,
-			.width = 1280,
-			.height = 720,
-		},
-		.reg_sequence = {
-			.regs = ar0234_720p_config,
-			.num_regs = ARRAY_SIZE(ar0234_720p_config),
-		},
-	},
-	{
-		.width = 960,
-		.height = 600,
-		.crop = {
-			.left = AR0234_PIXEL_ARRAY_LEFT,
-			.top = AR0234_PIXEL_ARRAY_TOP,
-			.width = 1920,
-			.height = 1200,
-		},
-		.reg_sequence = {
-			.regs = ar0234_960x600_config,
-			.num_regs = ARRAY_SIZE(ar0234_960x600_config),
-		},
-	},
+/*
+ * Registers that are changed by the sensor itself, have side effects on write
+ * or alias bits of other registers. These always bypass the register cache.
+ */
+static const struct regmap_range ar0234_volatile_ranges[] = {
+	regmap_reg_range(0x3000, 0x3001), /* CHIP_ID */
+	regmap_reg_range(0x301A, 0x301D), /* RESET, MODE_SELECT, ORIENTATION */
+	regmap_reg_range(0x3022, 0x3022), /* GROUPED_PARAMETER_HOLD */
+	regmap_reg_range(0x303A, 0x303B), /* FRAME_COUNT */
+	regmap_reg_range(0x3040, 0x3041), /* READ_MODE */
+	regmap_reg_range(0x3086, 0x3089), /* SEQ_DATA_PORT, SEQ_CTRL_PORT */
+	regmap_reg_range(0x30B2, 0x30B3), /* TEMPSENS_DATA */
+	regmap_reg_range(0x30C6, 0x30C9), /* TEMPSENS_CALIB1, TEMPSENS_CALIB2 */
+};
+
+static const struct regmap_access_table ar0234_volatile_table = {
+	.yes_ranges = ar0234_volatile_ranges,
+	.n_yes_ranges = ARRAY_SIZE(ar0234_volatile_ranges),
+};
+
+/*
+ * Same layout as devm_cci_regmap_init_i2c(), with a register cache. All
+ * access holds the control handler lock instead of a regmap lock, see
+ * struct ar0234.
+ */
+static const struct regmap_config ar0234_regmap_config = {
+	.reg_bits = AR0234_REG_ADDRESS_BITS,
+	.val_bits = 8,
+	.reg_format_endian = REGMAP_ENDIAN_BIG,
+	.max_register = AR0234_REG_ADDRESS_MAX,
+	.cache_type = REGCACHE_MAPLE,
+	.volatile_table = &ar0234_volatile_table,
+	.disable_locking = true,
 };
 
 struct ar0234_fmt_codes {
@@ -410,6 +561,7 @@ struct ar0234_fmt_codes {
 struct ar0234_pll_config {
 	s64 freq_link;
 	u32 freq_extclk;
+	u8 bit_depth;
 	struct ar0234_reg_sequence regs_pll;
 	struct ar0234_fmt_codes fmt_codes;
 };
@@ -418,6 +570,7 @@ static const struct ar0234_pll_config ar0234_pll_configs[] = {
 	{
 		.freq_link = AR0234_FREQ_LINK_8BIT,
 		.freq_extclk = AR0234_FREQ_EXTCLK,
+		.bit_depth = 8,
 		.regs_pll = {
 			.regs = ar0234_pll_config_24_360_8bit,
 			.num_regs = ARRAY_SIZE(ar0234_pll_config_24_360_8bit),
@@ -430,6 +583,7 @@ static const struct ar0234_pll_config ar0234_pll_configs[] = {
 	{
 		.freq_link = AR0234_FREQ_LINK_10BIT,
 		.freq_extclk = AR0234_FREQ_EXTCLK,
+		.bit_depth = 10,
 		.regs_pll = {
 			.regs = ar0234_pll_config_24_450_10bit,
 			.num_regs = ARRAY_SIZE(ar0234_pll_config_24_450_10bit),
@@ -441,6 +595,52 @@ static const struct ar0234_pll_config ar0234_pll_configs[] = {
 	},
 };
 
+#define AR0234_NUM_PLL_CONFIGS ARRAY_SIZE(ar0234_pll_configs)
+
+/*
+ * Optional firmware adding PLL configs and modes, all fields little endian:
+ * the header, num_plls PLL configs each followed by its num_regs register
+ * writes, then num_modes mode descriptors.
+ */
+#define AR0234_FIRMWARE "ar0234.bin"
+#define AR0234_FW_MAGIC 0x34333241 /* "A234" */
+#define AR0234_FW_VERSION 1
+#define AR0234_FW_PLLS_MAX 4
+#define AR0234_FW_PLL_REGS_MAX 32
+#define AR0234_FW_MODES_MAX 16
+
+struct ar0234_fw_header {
+	__le32 magic;
+	__le16 version;
+	__le16 num_plls;
+	__le16 num_modes;
+	__le16 reserved;
+} __packed;
+
+struct ar0234_fw_pll {
+	__le64 freq_link;
+	__le32 freq_extclk;
+	u8 bit_depth;
+	u8 reserved;
+	__le16 num_regs;
+} __packed;
+
+struct ar0234_fw_reg {
+	__le16 addr;
+	__le16 val;
+} __packed;
+
+struct ar0234_fw_mode {
+	__le16 crop_width;
+	__le16 crop_height;
+	u8 x_inc;
+	u8 y_inc;
+	u8 bin;
+	u8 reserved;
+} __packed;
+
+#define AR0234_PLL_CONFIGS_MAX (AR0234_NUM_PLL_CONFIGS + AR0234_FW_PLLS_MAX)
+
 /* Pixel clock frequencies are based on lane count */
 static const u32 ar0234_freq_pixclk[] = {
 	[AR0234_LANE_COUNT_ID_2LANE] = AR0234_FREQ_PIXCLK_45MHZ,
@@ -451,11 +651,62 @@ struct ar0234_hw_config {
 	struct clk *extclk;
 	struct regulator_bulk_data supplies[AR0234_NUM_SUPPLIES];
 	struct gpio_desc *gpio_reset;
+	unsigned long extclk_frequency;
 	unsigned int num_data_lanes;
 	enum ar0234_lane_count_id lane_count_id;
 	int trigger_mode;
+	u32 sync_group;
 	bool flash_enable;
 	s8 flash_delay;
+	u32 autosuspend_delay_ms;
+	bool standby_idle;
+};
+
+/* Timed phases of power on, stream start and control writes */
+enum ar0234_phase {
+	AR0234_PHASE_POWER_ON,
+	AR0234_PHASE_RESET,
+	AR0234_PHASE_INIT,
+	AR0234_PHASE_MODE,
+	AR0234_PHASE_CONTROLS,
+	AR0234_PHASE_STREAM_ON,
+	AR0234_PHASE_CTRL,
+	AR0234_NUM_PHASES,
+};
+
+static const char *const ar0234_phase_names[] = {
+	[AR0234_PHASE_POWER_ON] = "power_on",
+	[AR0234_PHASE_RESET] = "reset",
+	[AR0234_PHASE_INIT] = "init",
+	[AR0234_PHASE_MODE] = "mode",
+	[AR0234_PHASE_CONTROLS] = "controls",
+	[AR0234_PHASE_STREAM_ON] = "stream_on",
+	[AR0234_PHASE_CTRL] = "ctrl",
+};
+
+struct ar0234_phase_stats {
+	u64 count;
+	u64 total_ns;
+	u64 min_ns;
+	u64 max_ns;
+	/* I2C transfers, including those of phases running concurrently */
+	u64 xfers;
+};
+
+struct ar0234_phase_timer {
+	ktime_t start;
+	u64 xfers;
+};
+
+/* Stream start and frame rate of one mode and link frequency */
+struct ar0234_selftest_result {
+	unsigned int mode_index;
+	unsigned int pll_index;
+	int ret;
+	u32 setup_us;
+	u32 xfers;
+	u32 expected_mfps;
+	u32 measured_mfps;
 };
 
 struct ar0234 {
@@ -463,31 +714,170 @@ struct ar0234 {
 	struct ar0234_hw_config hw_config;
 	struct ar0234_pll_config const *pll_config;
 
+	/* PLL configs matching the DT link frequencies, in DT order */
+	struct ar0234_pll_config const *pll_configs[AR0234_PLL_CONFIGS_MAX];
+	s64 link_freqs[AR0234_PLL_CONFIGS_MAX];
+	unsigned int num_pll_configs;
+
+	/* Merged full init register list of each of the PLL configs */
+	struct ar0234_reg_sequence init_seqs[AR0234_PLL_CONFIGS_MAX];
+
+	/* PLL configs and mode descriptors loaded from firmware */
+	struct ar0234_pll_config *fw_pll_configs;
+	unsigned int num_fw_pll_configs;
+	struct ar0234_mode_desc *fw_mode_descs;
+	unsigned int num_fw_mode_descs;
+
+	/*
+	 * Every register access, and with it the register cache, is serialized
+	 * by the control handler lock. Stream start programs the sensor with
+	 * init_running set instead, see ar0234_start_streaming(). Only probe
+	 * accesses the sensor before the controls exist, when nothing else can
+	 * run yet.
+	 */
 	struct regmap *regmap;
 
 	struct v4l2_subdev sd;
 	struct media_pad pad[NUM_PADS];
 
-	struct v4l2_mbus_framefmt fmt;
-
 	bool monochrome;
 
 	struct v4l2_ctrl_handler ctrl_handler;
 	/* V4L2 Controls */
-	struct v4l2_ctrl *exposure;
+	struct {
+		/*
+		 * Exposure cluster, written in one grouped parameter hold.
+		 * VBLANK is last, its notify sees the cluster committed.
+		 */
+		struct v4l2_ctrl *exposure;
+		struct v4l2_ctrl *again;
+		struct v4l2_ctrl *dgain;
+		struct v4l2_ctrl *flash_enable;
+		struct v4l2_ctrl *flash_delay;
+		struct v4l2_ctrl *flash_polarity;
+		struct v4l2_ctrl *exposure_fine;
+		struct v4l2_ctrl *vblank;
+	};
 	struct v4l2_ctrl *vflip;
 	struct v4l2_ctrl *hflip;
-	struct v4l2_ctrl *vblank;
+	struct v4l2_ctrl *test_pattern;
 	struct v4l2_ctrl *hblank;
-
+	struct v4l2_ctrl *context;
+	struct v4l2_ctrl *context_b_mode;
+	struct v4l2_ctrl *link_freq;
+	struct v4l2_ctrl *pixel_rate;
+	struct v4l2_ctrl *trigger_mode;
+	struct v4l2_ctrl *trigger_latency;
+	struct v4l2_ctrl *sync_group;
+
+	/* Written with both the state and the control handler lock held */
 	const struct ar0234_mode *cur_mode;
 	u16 mfr_30ba;
 
-	/* Protects pad format and streaming state */
+	/* Mode built from the crop rectangle set through set_selection */
+	struct ar0234_mode roi_mode;
+	struct cci_reg_sequence roi_regs[AR0234_MODE_NUM_REGS];
+
+	/*
+	 * Modes generated from ar0234_mode_descs and the firmware descriptors
+	 * at probe, and their names
+	 */
+	struct ar0234_mode *modes;
+	const char **mode_names;
+	unsigned int num_modes;
+
+	/* Nesting depth of grouped parameter hold sections */
+	unsigned int hold_depth;
+	/* Userspace holds a section open through the group hold control */
+	bool user_hold;
+	struct v4l2_ctrl *group_hold;
+
+	/* Exposure time in us, set through exposure, HBLANK and VBLANK */
+	struct v4l2_ctrl *exposure_us;
+	bool exposure_us_busy;
+
+	/*
+	 * Subdev state lock, protects pad format and streaming state. Taken
+	 * before the control handler lock, never from s_ctrl.
+	 */
 	struct mutex mutex;
 
-	/* Streaming on/off */
+	/* Image stream on/off, also written under the control handler lock */
 	bool streaming;
+
+	/* Embedded data and statistics lines on/off */
+	bool metadata_streaming;
+
+	/* Register state is unknown, reset and fully program the sensor */
+	bool reset_needed;
+
+	/*
+	 * Stream start owns the registers while it resets and programs the
+	 * sensor, controls only store their values. Written under both locks.
+	 */
+	bool init_running;
+
+	/* Released from a hardware reset at power on, no soft reset needed */
+	bool hw_reset;
+
+	/* End of the internal initialization started by the last reset */
+	ktime_t ready_time;
+
+	/* Supplies and EXTCLK are on, possibly idle in software standby */
+	bool powered;
+
+	/* Entry in ar0234_devices, sync group state below under its lock */
+	struct list_head list;
+	/* Programmed and waiting for the rest of the sync group */
+	bool sync_armed;
+	/*
+	 * Time from the first stream on register write of the sync group to
+	 * this sensor's own, in ns. Not a frame start skew.
+	 */
+	s32 sync_stream_on_skew_ns;
+	/*
+	 * Another member failed to switch this sensor on. Reported until the
+	 * stream stops, protected by the control handler lock.
+	 */
+	int sync_error;
+
+	/* Factory temperature sensor calibration, zero if unusable */
+	u16 temp_calib[2];
+	/* Last temperature read while streaming, in millidegrees Celsius */
+	int temperature;
+	/* Refreshes temperature, runs under the control handler lock */
+	struct delayed_work temp_work;
+
+	/* FLASH output interrupt, enabled while streaming, or 0 */
+	int irq;
+	/* Exposures started since the stream start */
+	u32 frame_sequence;
+	/* Last exposure start, passed from the hard to the threaded handler */
+	ktime_t frame_sync_time;
+	u32 frame_sync_sequence;
+
+	/* I2C transfers issued through the regmap bus */
+	atomic64_t xfers;
+	/* Regmap bus with the transfer limits of the adapter */
+	struct regmap_bus regmap_bus;
+	/* Phase timing statistics, reset by writing the debugfs file */
+	spinlock_t stats_lock;
+	struct ar0234_phase_stats stats[AR0234_NUM_PHASES];
+	struct dentry *debugfs;
+
+	/* Register window read through debugfs, in 16-bit registers */
+	u32 dbg_reg_addr;
+	u32 dbg_reg_count;
+	/*
+	 * Registers written through debugfs, replayed after every sensor init.
+	 * Protected by the control handler lock.
+	 */
+	struct cci_reg_sequence reg_patch[AR0234_REG_PATCH_MAX];
+	unsigned int num_reg_patch;
+
+	/* Last self-test run, protected by the subdev state lock */
+	struct ar0234_selftest_result *selftest;
+	unsigned int num_selftest;
 };
 
 static inline struct ar0234 *to_ar0234(struct v4l2_subdev *_sd)
@@ -495,995 +885,3697 @@ static inline struct ar0234 *to_ar0234(struct v4l2_subdev *_sd)
 	return container_of(_sd, struct ar0234, sd);
 }
 
-static u32 ar0234_get_format_code(struct ar0234 *ar0234)
+static void ar0234_phase_begin(struct ar0234 *ar0234, enum ar0234_phase phase,
+			       struct ar0234_phase_timer *timer)
 {
-	u32 code;
-
-	if (ar0234->monochrome)
-		code = ar0234->pll_config->fmt_codes.mono;
-	else
-		code = ar0234->pll_config->fmt_codes.bayer;
+	trace_ar0234_phase_begin(ar0234->dev, ar0234_phase_names[phase]);
 
-	return code;
+	timer->xfers = atomic64_read(&ar0234->xfers);
+	timer->start = ktime_get();
 }
 
-static void ar0234_set_default_format(struct ar0234 *ar0234)
+/* Account a finished phase, returns its duration in ns */
+static u64 ar0234_phase_end(struct ar0234 *ar0234, enum ar0234_phase phase,
+			    struct ar0234_phase_timer *timer, int ret)
 {
-	struct v4l2_mbus_framefmt *fmt;
+	struct ar0234_phase_stats *stats = &ar0234->stats[phase];
+	u64 duration = ktime_to_ns(ktime_sub(ktime_get(), timer->start));
+	u64 xfers = atomic64_read(&ar0234->xfers) - timer->xfers;
 
-	fmt = &ar0234->fmt;
-	fmt->code = ar0234_get_format_code(ar0234);
+	trace_ar0234_phase_end(ar0234->dev, ar0234_phase_names[phase],
+			       duration, xfers, ret);
 
-	fmt->colorspace = V4L2_COLORSPACE_SRGB;
-	fmt->ycbcr_enc = V4L2_MAP_YCBCR_ENC_DEFAULT(fmt->colorspace);
-	fmt->quantization = V4L2_MAP_QUANTIZATION_DEFAULT(true, fmt->colorspace,
-							  fmt->ycbcr_enc);
-	fmt->xfer_func = V4L2_MAP_XFER_FUNC_DEFAULT(fmt->colorspace);
-	fmt->width = ar0234_modes[0].width;
-	fmt->height = ar0234_modes[0].height;
-	fmt->field = V4L2_FIELD_NONE;
+	spin_lock(&ar0234->stats_lock);
+
+	if (!stats->count || duration < stats->min_ns)
+		stats->min_ns = duration;
+	stats->max_ns = max(stats->max_ns, duration);
+	stats->total_ns += duration;
+	stats->xfers += xfers;
+	stats->count++;
+
+	spin_unlock(&ar0234->stats_lock);
 
-	ar0234->cur_mode = &ar0234_modes[0];
+	return duration;
 }
 
-static int ar0234_open(struct v4l2_subdev *sd, struct v4l2_subdev_fh *fh)
+/* Same transfers as regmap-i2c, counted for the timing statistics */
+static int ar0234_regmap_bus_write(void *context, const void *data,
+				   size_t count)
 {
-	struct ar0234 *ar0234 = to_ar0234(sd);
-	struct v4l2_mbus_framefmt *try_fmt_img =
-		v4l2_subdev_state_get_format(fh->state, IMAGE_PAD);
-	struct v4l2_mbus_framefmt *try_fmt_meta =
-		v4l2_subdev_state_get_format(fh->state, METADATA_PAD);
-	struct v4l2_rect *try_crop;
-
-	mutex_lock(&ar0234->mutex);
+	struct ar0234 *ar0234 = context;
+	struct i2c_client *client = to_i2c_client(ar0234->dev);
+	int ret;
 
-	/* Initialize try_fmt for the image pad */
-	try_fmt_img->width = ar0234_modes[0].width;
-	try_fmt_img->height = ar0234_modes[0].height;
-	try_fmt_img->code = ar0234_get_format_code(ar0234);
-	try_fmt_img->field = V4L2_FIELD_NONE;
-
-	/* Initialize try_fmt for the embedded metadata pad */
-	try_fmt_meta->width = AR0234_EMBEDDED_LINE_WIDTH;
-	try_fmt_meta->height = AR0234_NUM_EMBEDDED_LINES;
-	try_fmt_meta->code = MEDIA_BUS_FMT_SENSOR_DATA;
-	try_fmt_meta->field = V4L2_FIELD_NONE;
-
-	/* Initialize try_crop rectangle */
-	try_crop = v4l2_subdev_state_get_crop(fh->state, IMAGE_PAD);
-	try_crop->top = AR0234_PIXEL_ARRAY_TOP;
-	try_crop->left = AR0234_PIXEL_ARRAY_LEFT;
-	try_crop->width = AR0234_PIXEL_ARRAY_WIDTH;
-	try_crop->height = AR0234_PIXEL_ARRAY_HEIGHT;
+	atomic64_inc(&ar0234->xfers);
 
-	mutex_unlock(&ar0234->mutex);
+	ret = i2c_master_send(client, data, count);
+	if (ret == count)
+		return 0;
 
-	return 0;
+	return ret < 0 ? ret : -EIO;
 }
 
-static void ar0234_adjust_exposure_range(struct ar0234 *ar0234)
+static int ar0234_regmap_bus_read(void *context, const void *reg,
+				  size_t reg_size, void *val, size_t val_size)
 {
-	int exposure_max = ar0234->cur_mode->height + ar0234->vblank->val -
-			   AR0234_FLL_OVERHEAD - 1;
+	struct ar0234 *ar0234 = context;
+	struct i2c_client *client = to_i2c_client(ar0234->dev);
+	struct i2c_msg xfer[2] = {
+		{
+			.addr = client->addr,
+			.len = reg_size,
+			.buf = (u8 *)reg,
+		},
+		{
+			.addr = client->addr,
+			.flags = I2C_M_RD,
+			.len = val_size,
+			.buf = val,
+		},
+	};
+	int ret;
 
-	__v4l2_ctrl_modify_range(ar0234->exposure, ar0234->exposure->minimum,
-				 exposure_max, ar0234->exposure->step,
-				 exposure_max);
+	atomic64_inc(&ar0234->xfers);
+
+	ret = i2c_transfer(client->adapter, xfer, ARRAY_SIZE(xfer));
+	if (ret == ARRAY_SIZE(xfer))
+		return 0;
+
+	return ret < 0 ? ret : -EIO;
 }
 
-static int ar0234_set_analog_gain(struct ar0234 *ar0234, u8 analog_gain)
+static const struct regmap_bus ar0234_regmap_bus = {
+	.write = ar0234_regmap_bus_write,
+	.read = ar0234_regmap_bus_read,
+};
+
+/*
+ * Check whether the register cache already holds the value. Volatile and not
+ * yet cached registers never match.
+ */
+static bool ar0234_reg_cached(struct ar0234 *ar0234, u32 reg, u64 val)
 {
+	u64 cached;
 	int ret;
-	u16 mfr_30ba_val;
 
-	/*
-	 * 0x30BA register value lookup based on PIXCLK frequency
-	 * and analog gain level.
-	 */
-	if (ar0234_freq_pixclk[ar0234->hw_config.lane_count_id] ==
-	    AR0234_FREQ_PIXCLK_45MHZ) {
-		if (analog_gain < 0x36)
-			mfr_30ba_val = AR0234_MFR_30BA_GAIN_BITS(6);
-		else
-			mfr_30ba_val = AR0234_MFR_30BA_GAIN_BITS(0);
-	} else {
-		if (analog_gain < 0x20)
-			mfr_30ba_val = AR0234_MFR_30BA_GAIN_BITS(2);
-		else if (analog_gain < 0x3A)
-			mfr_30ba_val = AR0234_MFR_30BA_GAIN_BITS(1);
-		else
-			mfr_30ba_val = AR0234_MFR_30BA_GAIN_BITS(0);
-	}
+	/* Cache only mode is global to the regmap */
+	lockdep_assert(lockdep_is_held(ar0234->ctrl_handler.lock) ||
+		       ar0234->init_running);
 
-	/* Use grouped parameter hold when 0x30BA needs to be updated. */
-	if (ar0234->mfr_30ba != mfr_30ba_val) {
-		ret = cci_write(ar0234->regmap,
-				AR0234_REG_GROUPED_PARAMETER_HOLD, true, NULL);
-		ret = cci_write(ar0234->regmap, AR0234_REG_MFR_30BA,
-				mfr_30ba_val, &ret);
-		ret = cci_write(ar0234->regmap, AR0234_REG_ANALOG_GAIN,
-				analog_gain, &ret);
-		ret = cci_write(ar0234->regmap,
-				AR0234_REG_GROUPED_PARAMETER_HOLD, false, &ret);
+	regcache_cache_only(ar0234->regmap, true);
+	ret = cci_read(ar0234->regmap, reg, &cached, NULL);
+	regcache_cache_only(ar0234->regmap, false);
 
-		/* Update cached value */
-		ar0234->mfr_30ba = mfr_30ba_val;
-	} else {
-		ret = cci_write(ar0234->regmap, AR0234_REG_ANALOG_GAIN,
-				analog_gain, NULL);
-	}
+	return !ret && cached == val;
+}
 
-	return ret;
+/*
+ * Regmap caches a value before writing it. After a failed write the sensor
+ * may not hold it, so that a later write of the same value must not be
+ * skipped.
+ */
+static void ar0234_cache_drop(struct ar0234 *ar0234, u32 addr,
+			      unsigned int len)
+{
+	regcache_drop_region(ar0234->regmap, addr, addr + len - 1);
 }
 
-static int ar0234_set_ctrl(struct v4l2_ctrl *ctrl)
+/* Write a register unless the register cache already holds the same value */
+static int ar0234_write(struct ar0234 *ar0234, u32 reg, u64 val, int *err)
 {
-	struct ar0234 *ar0234 =
-		container_of(ctrl->handler, struct ar0234, ctrl_handler);
-	struct i2c_client *client = v4l2_get_subdevdata(&ar0234->sd);
 	int ret;
 
-	if (ctrl->id == V4L2_CID_VBLANK)
-		ar0234_adjust_exposure_range(ar0234);
+	if (err && *err)
+		return *err;
 
-	/*
-	 * Applying V4L2 control value only happens
-	 * when power is up for streaming
-	 */
-	if (pm_runtime_get_if_in_use(&client->dev) == 0)
+	if (ar0234_reg_cached(ar0234, reg, val))
 		return 0;
 
-	switch (ctrl->id) {
-	case V4L2_CID_ANALOGUE_GAIN:
-		ret = ar0234_set_analog_gain(ar0234, ctrl->val);
-		break;
-	case V4L2_CID_EXPOSURE:
-		ret = cci_write(ar0234->regmap, AR0234_REG_EXPOSURE_COARSE,
-				ctrl->val, NULL);
-		break;
-	case V4L2_CID_DIGITAL_GAIN:
-		ret = cci_write(ar0234->regmap, AR0234_REG_DIGITAL_GAIN,
-				ctrl->val, NULL);
-		break;
-	case V4L2_CID_TEST_PATTERN:
-		ret = cci_write(ar0234->regmap, AR0234_REG_TEST_PATTERN_MODE,
-				ar0234_test_pattern_val[ctrl->val], NULL);
-		break;
-	case V4L2_CID_TEST_PATTERN_RED:
-		ret = cci_write(ar0234->regmap, AR0234_REG_TEST_DATA_RED,
-				ctrl->val, NULL);
-		break;
-	case V4L2_CID_TEST_PATTERN_GREENR:
-		ret = cci_write(ar0234->regmap, AR0234_REG_TEST_DATA_GREENR,
-				ctrl->val, NULL);
-		break;
-	case V4L2_CID_TEST_PATTERN_BLUE:
-		ret = cci_write(ar0234->regmap, AR0234_REG_TEST_DATA_BLUE,
-				ctrl->val, NULL);
-		break;
-	case V4L2_CID_TEST_PATTERN_GREENB:
-		ret = cci_write(ar0234->regmap, AR0234_REG_TEST_DATA_GREENB,
-				ctrl->val, NULL);
-		break;
-	case V4L2_CID_HFLIP:
-	case V4L2_CID_VFLIP:
-		ret = cci_write(ar0234->regmap, AR0234_REG_IMAGE_ORIENTATION,
-				(ar0234->vflip->val << 1) | ar0234->hflip->val,
-				NULL);
-		break;
-	case V4L2_CID_VBLANK:
-		ret = cci_write(ar0234->regmap, AR0234_REG_FRAME_LENGTH_LINES,
-				ar0234->cur_mode->height + ctrl->val -
-					AR0234_FLL_OVERHEAD,
-				NULL);
-		break;
-	case V4L2_CID_HBLANK:
-		ret = -EINVAL;
-		break;
-	default:
-		dev_info(&client->dev,
-			 "ctrl(id:0x%x,val:0x%x) is not handled\n", ctrl->id,
-			 ctrl->val);
-		ret = -EINVAL;
-		break;
-	}
-
-	pm_runtime_mark_last_busy(&client->dev);
-	pm_runtime_put_autosuspend(&client->dev);
+	ret = cci_write(ar0234->regmap, reg, val, err);
+	if (ret)
+		ar0234_cache_drop(ar0234, CCI_REG_ADDR(reg),
+				  CCI_REG_WIDTH_BYTES(reg));
 
 	return ret;
 }
 
-static const struct v4l2_ctrl_ops ar0234_ctrl_ops = {
-	.s_ctrl = ar0234_set_ctrl,
-};
-
-static int ar0234_enum_mbus_code(struct v4l2_subdev *sd,
-				 struct v4l2_subdev_state *sd_state,
-				 struct v4l2_subdev_mbus_code_enum *code)
+static int ar0234_update_bits(struct ar0234 *ar0234, u32 reg, u64 mask,
+			      u64 val, int *err)
 {
-	struct ar0234 *ar0234 = to_ar0234(sd);
-
-	if (code->pad >= NUM_PADS)
-		return -EINVAL;
-
-	if (code->pad == IMAGE_PAD) {
-		if (code->index >= AR0234_NUM_FMT_CODES)
-			return -EINVAL;
+	u64 readval;
+	int ret;
 
-		code->code = ar0234_get_format_code(ar0234);
-	} else {
-		if (code->index > 0)
-			return -EINVAL;
+	if (err && *err)
+		return *err;
 
-		code->code = MEDIA_BUS_FMT_SENSOR_DATA;
-	}
+	/* Served from the cache unless the register has not been touched */
+	ret = cci_read(ar0234->regmap, reg, &readval, err);
+	if (ret)
+		return ret;
 
-	return 0;
+	return ar0234_write(ar0234, reg, (readval & ~mask) | (val & mask), err);
 }
 
-static int ar0234_enum_frame_size(struct v4l2_subdev *sd,
-				  struct v4l2_subdev_state *sd_state,
-				  struct v4l2_subdev_frame_size_enum *fse)
+/*
+ * Write a register sequence. Changed registers at consecutive addresses are
+ * merged into a single auto-increment I2C burst, unchanged ones are skipped.
+ */
+static int ar0234_write_regs(struct ar0234 *ar0234,
+			     const struct cci_reg_sequence *regs,
+			     unsigned int num_regs)
 {
-	struct ar0234 *ar0234 = to_ar0234(sd);
+	struct regmap *regmap = ar0234->regmap;
+	u8 buf[AR0234_BURST_MAX_BYTES];
+	unsigned int start = 0;
+	unsigned int len = 0;
+	unsigned int i;
+	int ret = 0;
 
-	if (fse->pad >= NUM_PADS)
-		return -EINVAL;
+	for (i = 0; i < num_regs && !ret; i++) {
+		u32 addr = CCI_REG_ADDR(regs[i].reg);
+		unsigned int width = CCI_REG_WIDTH_BYTES(regs[i].reg);
 
-	if (fse->pad == IMAGE_PAD) {
-		if (fse->index >= ARRAY_SIZE(ar0234_modes))
-			return -EINVAL;
+		if (ar0234_reg_cached(ar0234, regs[i].reg, regs[i].val))
+			continue;
 
-		if (fse->code != ar0234_get_format_code(ar0234))
-			return -EINVAL;
+		/* Send the pending burst unless this register extends it */
+		if (len &&
+		    (addr != start + len || len + width > sizeof(buf))) {
+			ret = regmap_bulk_write(regmap, start, buf, len);
+			if (ret)
+				ar0234_cache_drop(ar0234, start, len);
+			len = 0;
+		}
 
-		fse->min_width = ar0234_modes[fse->index].width;
-		fse->max_width = fse->min_width;
-		fse->min_height = ar0234_modes[fse->index].height;
-		fse->max_height = fse->min_height;
-	} else {
-		if (fse->code != MEDIA_BUS_FMT_SENSOR_DATA || fse->index > 0)
-			return -EINVAL;
+		if (!len)
+			start = addr;
 
-		fse->min_width = AR0234_EMBEDDED_LINE_WIDTH;
-		fse->max_width = fse->min_width;
-		fse->min_height = AR0234_NUM_EMBEDDED_LINES;
-		fse->max_height = fse->min_height;
+		/* Big endian, most significant byte at the lowest address */
+		while (width--)
+			buf[len++] = regs[i].val >> (width * 8);
 	}
 
-	return 0;
+	if (!ret && len) {
+		ret = regmap_bulk_write(regmap, start, buf, len);
+		if (ret)
+			ar0234_cache_drop(ar0234, start, len);
+	}
+
+	return ret;
 }
 
-static void ar0234_reset_colorspace(struct v4l2_mbus_framefmt *fmt)
-{
-	fmt->colorspace = V4L2_COLORSPACE_SRGB;
-	fmt->ycbcr_enc = V4L2_MAP_YCBCR_ENC_DEFAULT(fmt->colorspace);
-	fmt->quantization = V4L2_MAP_QUANTIZATION_DEFAULT(true, fmt->colorspace,
-							  fmt->ycbcr_enc);
-	fmt->xfer_func = V4L2_MAP_XFER_FUNC_DEFAULT(fmt->colorspace);
+/*
+ * Grouped parameter hold sections may nest, only the outermost one latches
+ * and releases the hold on the sensor.
+ */
+static void ar0234_group_hold_begin(struct ar0234 *ar0234, int *err)
+{
+	if (ar0234->hold_depth++)
+		return;
+
+	cci_write(ar0234->regmap, AR0234_REG_GROUPED_PARAMETER_HOLD, true, err);
 }
 
-static void ar0234_update_image_pad_format(struct ar0234 *ar0234,
-					   const struct ar0234_mode *mode,
-					   struct v4l2_subdev_format *fmt)
+static void ar0234_group_hold_end(struct ar0234 *ar0234, int *err)
 {
-	fmt->format.width = mode->width;
-	fmt->format.height = mode->height;
-	fmt->format.field = V4L2_FIELD_NONE;
-	ar0234_reset_colorspace(&fmt->format);
+	int ret;
+
+	if (--ar0234->hold_depth)
+		return;
+
+	/* Release the hold even when a write inside the section failed */
+	ret = cci_write(ar0234->regmap, AR0234_REG_GROUPED_PARAMETER_HOLD,
+			false, NULL);
+	if (err && !*err)
+		*err = ret;
 }
 
-static void ar0234_update_metadata_pad_format(struct v4l2_subdev_format *fmt)
+static inline int
+ar0234_reg_seq_write(struct ar0234 *ar0234,
+		     struct ar0234_reg_sequence const *reg_sequence)
 {
-	fmt->format.width = AR0234_EMBEDDED_LINE_WIDTH;
-	fmt->format.height = AR0234_NUM_EMBEDDED_LINES;
-	fmt->format.code = MEDIA_BUS_FMT_SENSOR_DATA;
-	fmt->format.field = V4L2_FIELD_NONE;
+	return ar0234_write_regs(ar0234, reg_sequence->regs,
+				 reg_sequence->num_regs);
 }
 
-static int __ar0234_get_pad_format(struct ar0234 *ar0234,
-				   struct v4l2_subdev_state *sd_state,
-				   struct v4l2_subdev_format *fmt)
+/*
+ * Output pixels per pixel clock cycle of a mode. Horizontal binning or
+ * skipping divides it, as the sensor reads out the whole crop width to
+ * produce each output line.
+ */
+static unsigned int ar0234_pixels_per_clk(const struct ar0234_mode *mode)
 {
-	if (fmt->pad >= NUM_PADS)
-		return -EINVAL;
-
-	if (fmt->which == V4L2_SUBDEV_FORMAT_TRY) {
-		struct v4l2_mbus_framefmt *try_fmt =
-			v4l2_subdev_state_get_format(sd_state, fmt->pad);
-		/* Update the code which could change due to vflip or hflip */
-		try_fmt->code = fmt->pad == IMAGE_PAD ?
-					ar0234_get_format_code(ar0234) :
-					MEDIA_BUS_FMT_SENSOR_DATA;
-		fmt->format = *try_fmt;
-	} else {
-		if (fmt->pad == IMAGE_PAD) {
-			ar0234_update_image_pad_format(ar0234, ar0234->cur_mode,
-						       fmt);
-			fmt->format.code = ar0234_get_format_code(ar0234);
-		} else {
-			ar0234_update_metadata_pad_format(fmt);
-		}
-	}
-
-	return 0;
+	return AR0234_PIXELS_PER_CLK * mode->width / mode->crop.width;
 }
 
-static int ar0234_get_pad_format(struct v4l2_subdev *sd,
-				 struct v4l2_subdev_state *sd_state,
-				 struct v4l2_subdev_format *fmt)
+/* LINE_LENGTH_PCK for an HBLANK of the current mode */
+static u32 ar0234_line_length_pck(struct ar0234 *ar0234, s32 hblank)
 {
-	struct ar0234 *ar0234 = to_ar0234(sd);
-	int ret;
+	return (ar0234->cur_mode->width + hblank) /
+	       ar0234_pixels_per_clk(ar0234->cur_mode);
+}
 
-	mutex_lock(&ar0234->mutex);
-	ret = __ar0234_get_pad_format(ar0234, sd_state, fmt);
-	mutex_unlock(&ar0234->mutex);
+/* Mode programmed into the context the sensor currently reads out */
+static const struct ar0234_mode *ar0234_active_mode(struct ar0234 *ar0234)
+{
+	if (ar0234->context->val == AR0234_CONTEXT_B)
+		return &ar0234->modes[ar0234->context_b_mode->val];
 
-	return ret;
+	return ar0234->cur_mode;
 }
 
-static void ar0234_set_framing_limits(struct ar0234 *ar0234)
+/* Translate a context A register to its copy in the active context */
+static u32 ar0234_context_reg(struct ar0234 *ar0234, u32 reg)
 {
-	int hblank;
-	const struct ar0234_mode *mode = ar0234->cur_mode;
+	unsigned int i;
 
-	/* Update limits and set FPS to default */
-	__v4l2_ctrl_modify_range(ar0234->vblank, AR0234_VBLANK_MIN,
-				 AR0234_FLL_MAX - mode->height,
-				 ar0234->vblank->step, AR0234_VBLANK_MIN);
+	if (ar0234->context->val != AR0234_CONTEXT_B)
+		return reg;
 
-	/* Setting this will adjust the exposure limits as well */
-	__v4l2_ctrl_s_ctrl(ar0234->vblank, AR0234_VBLANK_MIN);
+	for (i = 0; i < ARRAY_SIZE(ar0234_context_regs); i++) {
+		if (ar0234_context_regs[i].reg_a == reg)
+			return ar0234_context_regs[i].reg_b;
+	}
 
-	hblank = AR0234_LINE_LENGTH_PCK_DEF - mode->width;
-	__v4l2_ctrl_modify_range(ar0234->hblank, hblank, hblank, 1, hblank);
-	__v4l2_ctrl_s_ctrl(ar0234->hblank, hblank);
+	return reg;
 }
 
-static int ar0234_set_pad_format(struct v4l2_subdev *sd,
-				 struct v4l2_subdev_state *sd_state,
-				 struct v4l2_subdev_format *fmt)
+/* Look up the value a mode writes to a register, or @def if it does not */
+static u64 ar0234_mode_reg_val(const struct ar0234_mode *mode, u32 reg,
+			       u64 def)
 {
-	struct ar0234 *ar0234 = to_ar0234(sd);
-	const struct ar0234_mode *mode;
-	struct v4l2_mbus_framefmt *framefmt;
-
-	if (fmt->pad >= NUM_PADS)
-		return -EINVAL;
+	const struct ar0234_reg_sequence *seq = &mode->reg_sequence;
+	unsigned int i;
 
-	mutex_lock(&ar0234->mutex);
+	for (i = 0; i < seq->num_regs; i++) {
+		if (seq->regs[i].reg == reg)
+			return seq->regs[i].val;
+	}
 
-	if (fmt->pad == IMAGE_PAD) {
-		fmt->format.code = ar0234_get_format_code(ar0234);
+	return def;
+}
 
-		mode = v4l2_find_nearest_size(ar0234_modes,
-					      ARRAY_SIZE(ar0234_modes), width,
-					      height, fmt->format.width,
-					      fmt->format.height);
-		ar0234_update_image_pad_format(ar0234, mode, fmt);
-		if (fmt->which == V4L2_SUBDEV_FORMAT_TRY) {
-			framefmt = v4l2_subdev_state_get_format(sd_state,
-								fmt->pad);
-			*framefmt = fmt->format;
-		} else if (ar0234->cur_mode != mode ||
-			   ar0234->fmt.code != fmt->format.code) {
-			ar0234->fmt = fmt->format;
-			ar0234->cur_mode = mode;
-			ar0234_set_framing_limits(ar0234);
-		}
-	} else {
-		if (fmt->which == V4L2_SUBDEV_FORMAT_TRY) {
-			framefmt = v4l2_subdev_state_get_format(sd_state,
-								fmt->pad);
-			*framefmt = fmt->format;
-		} else {
-			/* Only one embedded data mode is supported */
-			ar0234_update_metadata_pad_format(fmt);
+/*
+ * Program the frame geometry of the context B mode. READ_MODE has no
+ * context B copy, its binning bits are switched together with the context.
+ */
+static int ar0234_context_b_preload(struct ar0234 *ar0234)
+{
+	const struct ar0234_mode *mode =
+		&ar0234->modes[ar0234->context_b_mode->val];
+	struct cci_reg_sequence regs[ARRAY_SIZE(ar0234_context_regs)];
+	unsigned int num_regs = 0;
+	unsigned int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(ar0234_context_regs); i++) {
+		const struct ar0234_reg_sequence *seq = &mode->reg_sequence;
+
+		for (j = 0; j < seq->num_regs; j++) {
+			if (seq->regs[j].reg != ar0234_context_regs[i].reg_a)
+				continue;
+
+			regs[num_regs].reg = ar0234_context_regs[i].reg_b;
+			regs[num_regs].val = seq->regs[j].val;
+			num_regs++;
+			break;
 		}
 	}
 
-	mutex_unlock(&ar0234->mutex);
+	return ar0234_write_regs(ar0234, regs, num_regs);
+}
 
-	return 0;
+/* Clamp a crop rectangle to the pixel array and align it */
+static void ar0234_adjust_crop(struct v4l2_rect *r)
+{
+	r->width = clamp_t(u32, ALIGN_DOWN(r->width, AR0234_CROP_WIDTH_ALIGN),
+			   AR0234_CROP_MIN_WIDTH, AR0234_PIXEL_ARRAY_WIDTH);
+	r->height = clamp_t(u32,
+			    ALIGN_DOWN(r->height, AR0234_CROP_HEIGHT_ALIGN),
+			    AR0234_CROP_MIN_HEIGHT, AR0234_PIXEL_ARRAY_HEIGHT);
+
+	r->left = clamp_t(s32, r->left, AR0234_PIXEL_ARRAY_LEFT,
+			  AR0234_PIXEL_ARRAY_LEFT + AR0234_PIXEL_ARRAY_WIDTH -
+				  r->width);
+	r->top = clamp_t(s32, r->top, AR0234_PIXEL_ARRAY_TOP,
+			 AR0234_PIXEL_ARRAY_TOP + AR0234_PIXEL_ARRAY_HEIGHT -
+				 r->height);
+
+	/* Keep even offsets to preserve the Bayer order */
+	r->left = AR0234_PIXEL_ARRAY_LEFT +
+		  ALIGN_DOWN(r->left - AR0234_PIXEL_ARRAY_LEFT, 2);
+	r->top = AR0234_PIXEL_ARRAY_TOP +
+		 ALIGN_DOWN(r->top - AR0234_PIXEL_ARRAY_TOP, 2);
 }
 
-static const struct v4l2_rect *
-__ar0234_get_pad_crop(struct ar0234 *ar0234, struct v4l2_subdev_state *sd_state,
-		      unsigned int pad, enum v4l2_subdev_format_whence which)
+/* ODD_INC value reading every @inc-th column or row, in Bayer pairs */
+static u16 ar0234_odd_inc(unsigned int inc)
 {
-	switch (which) {
-	case V4L2_SUBDEV_FORMAT_TRY:
-		return v4l2_subdev_state_get_crop(sd_state, pad);
-	case V4L2_SUBDEV_FORMAT_ACTIVE:
-		return &ar0234->cur_mode->crop;
-	}
+	return 2 * inc - 1;
+}
 
-	return NULL;
+/*
+ * Build the register sequence reading out @crop with every @x_inc-th
+ * column and @y_inc-th row, binning the skipped ones if @bin is set.
+ */
+static void ar0234_build_mode(struct ar0234_mode *mode,
+			      struct cci_reg_sequence *regs,
+			      const struct v4l2_rect *crop, unsigned int x_inc,
+			      unsigned int y_inc, bool bin)
+{
+	u32 x_start = crop->left - AR0234_PIXEL_ARRAY_LEFT +
+		      AR0234_ADDR_START_MIN;
+	u32 y_start = crop->top - AR0234_PIXEL_ARRAY_TOP +
+		      AR0234_ADDR_START_MIN;
+	u16 read_mode = 0;
+
+	if (bin && x_inc > 1)
+		read_mode |= AR0234_READ_MODE_COL_BIN;
+	if (bin && y_inc > 1)
+		read_mode |= AR0234_READ_MODE_ROW_BIN;
+
+	regs[0] = (struct cci_reg_sequence){ AR0234_REG_Y_ADDR_START, y_start };
+	regs[1] = (struct cci_reg_sequence){ AR0234_REG_X_ADDR_START, x_start };
+	regs[2] = (struct cci_reg_sequence){ AR0234_REG_Y_ADDR_END,
+					     y_start + crop->height - 1 };
+	regs[3] = (struct cci_reg_sequence){ AR0234_REG_X_ADDR_END,
+					     x_start + crop->width - 1 };
+	regs[4] = (struct cci_reg_sequence){ AR0234_REG_X_ODD_INC,
+					     ar0234_odd_inc(x_inc) };
+	regs[5] = (struct cci_reg_sequence){ AR0234_REG_Y_ODD_INC,
+					     ar0234_odd_inc(y_inc) };
+	regs[6] = (struct cci_reg_sequence){ AR0234_REG_READ_MODE, read_mode };
+
+	mode->width = crop->width / x_inc;
+	mode->height = crop->height / y_inc;
+	mode->crop = *crop;
+	mode->reg_sequence.regs = regs;
+	mode->reg_sequence.num_regs = AR0234_MODE_NUM_REGS;
 }
 
-static int ar0234_get_selection(struct v4l2_subdev *sd,
-				struct v4l2_subdev_state *sd_state,
-				struct v4l2_subdev_selection *sel)
+/* Build the register sequence for a full resolution readout of @crop */
+static void ar0234_set_roi_mode(struct ar0234 *ar0234,
+				const struct v4l2_rect *crop)
 {
-	switch (sel->target) {
-	case V4L2_SEL_TGT_CROP: {
-		struct ar0234 *ar0234 = to_ar0234(sd);
+	ar0234_build_mode(&ar0234->roi_mode, ar0234->roi_regs, crop, 1, 1,
+			  false);
+}
 
-		mutex_lock(&ar0234->mutex);
-		sel->r = *__ar0234_get_pad_crop(ar0234, sd_state, sel->pad,
-						sel->which);
-		mutex_unlock(&ar0234->mutex);
+/*
+ * Generate the mode list from ar0234_mode_descs, followed by the firmware
+ * ones. Windows are centered on the pixel array, the frame timing limits
+ * of each mode follow from its crop and output size in
+ * ar0234_set_framing_limits().
+ */
+static int ar0234_build_modes(struct ar0234 *ar0234)
+{
+	unsigned int num_static = ARRAY_SIZE(ar0234_mode_descs);
+	unsigned int num_modes = num_static + ar0234->num_fw_mode_descs;
+	struct cci_reg_sequence *regs;
+	unsigned int i;
+
+	ar0234->modes = devm_kcalloc(ar0234->dev, num_modes,
+				     sizeof(*ar0234->modes), GFP_KERNEL);
+	ar0234->mode_names = devm_kcalloc(ar0234->dev, num_modes,
+					  sizeof(*ar0234->mode_names),
+					  GFP_KERNEL);
+	regs = devm_kcalloc(ar0234->dev, num_modes * AR0234_MODE_NUM_REGS,
+			    sizeof(*regs), GFP_KERNEL);
+	if (!ar0234->modes || !ar0234->mode_names || !regs)
+		return -ENOMEM;
 
-		return 0;
+	for (i = 0; i < num_modes; i++) {
+		const struct ar0234_mode_desc *desc =
+			i < num_static ? &ar0234_mode_descs[i] :
+					 &ar0234->fw_mode_descs[i - num_static];
+		struct ar0234_mode *mode = &ar0234->modes[i];
+		struct v4l2_rect crop;
+		const char *name;
+
+		crop.width = desc->crop_width;
+		crop.height = desc->crop_height;
+		crop.left = AR0234_PIXEL_ARRAY_LEFT +
+			    (AR0234_PIXEL_ARRAY_WIDTH - crop.width) / 2;
+		crop.top = AR0234_PIXEL_ARRAY_TOP +
+			   (AR0234_PIXEL_ARRAY_HEIGHT - crop.height) / 2;
+		/* Even offsets keep the Bayer order */
+		ar0234_adjust_crop(&crop);
+
+		ar0234_build_mode(mode, &regs[i * AR0234_MODE_NUM_REGS], &crop,
+				  desc->x_inc, desc->y_inc, desc->bin);
+
+		if (desc->x_inc == 1 && desc->y_inc == 1)
+			name = devm_kasprintf(ar0234->dev, GFP_KERNEL, "%ux%u",
+					      mode->width, mode->height);
+		else
+			name = devm_kasprintf(ar0234->dev, GFP_KERNEL,
+					      "%ux%u (%ux%u %s)", mode->width,
+					      mode->height, desc->x_inc,
+					      desc->y_inc,
+					      desc->bin ? "binned" : "skipped");
+		if (!name)
+			return -ENOMEM;
+
+		ar0234->mode_names[i] = name;
 	}
 
-	case V4L2_SEL_TGT_NATIVE_SIZE:
-		sel->r.top = 0;
-		sel->r.left = 0;
-		sel->r.width = AR0234_NATIVE_WIDTH;
-		sel->r.height = AR0234_NATIVE_HEIGHT;
+	ar0234->num_modes = num_modes;
 
-		return 0;
+	return 0;
+}
 
-	case V4L2_SEL_TGT_CROP_DEFAULT:
-	case V4L2_SEL_TGT_CROP_BOUNDS:
-		sel->r.top = AR0234_PIXEL_ARRAY_TOP;
-		sel->r.left = AR0234_PIXEL_ARRAY_LEFT;
-		sel->r.width = AR0234_PIXEL_ARRAY_WIDTH;
-		sel->r.height = AR0234_PIXEL_ARRAY_HEIGHT;
+static u32 ar0234_pll_format_code(struct ar0234 *ar0234,
+				  const struct ar0234_pll_config *pll_config)
+{
+	u32 code;
 
-		return 0;
-	}
+	if (ar0234->monochrome)
+		code = pll_config->fmt_codes.mono;
+	else
+		code = pll_config->fmt_codes.bayer;
 
-	return -EINVAL;
+	return code;
 }
 
-static int ar0234_soft_reset(struct ar0234 *ar0234)
+/* Embedded data lines are packed at the bit depth of the image (bytes) */
+static u32
+ar0234_metadata_line_width(const struct ar0234_pll_config *pll_config)
 {
-	int ret;
+	return AR0234_PIXEL_ARRAY_WIDTH * pll_config->bit_depth / 8;
+}
 
-	/* 20ms */
-	usleep_range(20000, 21000);
+/* Index of the PLL config producing @code, or -EINVAL */
+static int ar0234_find_pll_config(struct ar0234 *ar0234, u32 code)
+{
+	unsigned int i;
 
-	ret = cci_write(ar0234->regmap, AR0234_REG_RESET, 0x0001, NULL);
+	for (i = 0; i < ar0234->num_pll_configs; i++) {
+		if (ar0234_pll_format_code(ar0234, ar0234->pll_configs[i]) ==
+		    code)
+			return i;
+	}
 
-	/* 200ms */
-	usleep_range(200000, 201000);
+	return -EINVAL;
+}
 
-	return cci_write(ar0234->regmap, AR0234_REG_RESET, AR0234_RESET_DEFAULT,
-			 &ret);
+/* Longest exposure in a frame of the active mode with @vblank */
+static int ar0234_exposure_max(struct ar0234 *ar0234, s32 vblank)
+{
+	return ar0234_active_mode(ar0234)->height + vblank -
+	       AR0234_FLL_OVERHEAD - 1;
 }
 
-static inline int
-ar0234_reg_seq_write(struct regmap *regmap,
-		     struct ar0234_reg_sequence const *reg_sequence)
+static void ar0234_adjust_exposure_range(struct ar0234 *ar0234)
 {
-	return cci_multi_reg_write(regmap, reg_sequence->regs,
-				   reg_sequence->num_regs, NULL);
+	int exposure_max = ar0234_exposure_max(ar0234, ar0234->vblank->val);
+
+	__v4l2_ctrl_modify_range(ar0234->exposure, ar0234->exposure->minimum,
+				 exposure_max, ar0234->exposure->step,
+				 exposure_max);
 }
 
-static int ar0234_pixclk_config(struct ar0234 *ar0234)
+/* Fine integration stays within one line */
+static void ar0234_adjust_exposure_fine_range(struct ar0234 *ar0234)
 {
-	int ret = 0;
+	int fine_max = ar0234_line_length_pck(ar0234, ar0234->hblank->val) - 1;
 
-	if (ar0234_freq_pixclk[ar0234->hw_config.lane_count_id] ==
-	    AR0234_FREQ_PIXCLK_45MHZ) {
-		ret = cci_multi_reg_write(ar0234->regmap,
-					  pixclk_45mhz_mfr_settings,
-					  ARRAY_SIZE(pixclk_45mhz_mfr_settings),
-					  NULL);
+	__v4l2_ctrl_modify_range(ar0234->exposure_fine, 0, fine_max, 1, 0);
+}
 
-		ret = cci_write(ar0234->regmap, AR0234_REG_MFR_30BA,
-				AR0234_MFR_30BA_GAIN_BITS(6), &ret);
+static int ar0234_set_analog_gain(struct ar0234 *ar0234, u8 analog_gain)
+{
+	int ret;
+	u16 mfr_30ba_val;
 
-		ar0234->mfr_30ba = AR0234_MFR_30BA_GAIN_BITS(6);
+	/*
+	 * 0x30BA register value lookup based on PIXCLK frequency
+	 * and analog gain level.
+	 */
+	if (ar0234_freq_pixclk[ar0234->hw_config.lane_count_id] ==
+	    AR0234_FREQ_PIXCLK_45MHZ) {
+		if (analog_gain < 0x36)
+			mfr_30ba_val = AR0234_MFR_30BA_GAIN_BITS(6);
+		else
+			mfr_30ba_val = AR0234_MFR_30BA_GAIN_BITS(0);
 	} else {
-		/*
-		 * Default value after reset. No need to write to register.
-		 * Just update the cached value.
-		 */
-		ar0234->mfr_30ba = AR0234_MFR_30BA_DEFAULT;
+		if (analog_gain < 0x20)
+			mfr_30ba_val = AR0234_MFR_30BA_GAIN_BITS(2);
+		else if (analog_gain < 0x3A)
+			mfr_30ba_val = AR0234_MFR_30BA_GAIN_BITS(1);
+		else
+			mfr_30ba_val = AR0234_MFR_30BA_GAIN_BITS(0);
 	}
 
+	/* Called inside the exposure cluster hold, both land in one frame */
+	ret = ar0234_write(ar0234, AR0234_REG_MFR_30BA, mfr_30ba_val, NULL);
+	ret = ar0234_write(ar0234, AR0234_REG_ANALOG_GAIN, analog_gain, &ret);
+
+	/* Update cached value */
+	ar0234->mfr_30ba = mfr_30ba_val;
+
 	return ret;
 }
 
-static inline int ar0234_mode_select(struct ar0234 *ar0234, bool stream_on)
+/* Write all changed controls of the exposure cluster in one grouped hold */
+static int ar0234_set_exposure_cluster(struct ar0234 *ar0234)
 {
-	return cci_write(ar0234->regmap, AR0234_REG_MODE_SELECT, stream_on,
-			 NULL);
+	int ret = 0;
+
+	ar0234_group_hold_begin(ar0234, &ret);
+
+	/* The exposure was clamped to a new frame length by try_ctrl */
+	if (ar0234->vblank->is_new)
+		ar0234_write(ar0234,
+			     ar0234_context_reg(ar0234,
+						AR0234_REG_FRAME_LENGTH_LINES),
+			     ar0234_active_mode(ar0234)->height +
+				     ar0234->vblank->val - AR0234_FLL_OVERHEAD,
+			     &ret);
+
+	if (ar0234->exposure->is_new || ar0234->vblank->is_new)
+		ar0234_write(ar0234,
+			     ar0234_context_reg(ar0234,
+						AR0234_REG_EXPOSURE_COARSE),
+			     ar0234->exposure->val, &ret);
+
+	if (ar0234->exposure_fine->is_new)
+		ar0234_write(ar0234,
+			     ar0234_context_reg(ar0234,
+						AR0234_REG_EXPOSURE_FINE),
+			     ar0234->exposure_fine->val, &ret);
+
+	if (ar0234->again->is_new && !ret)
+		ret = ar0234_set_analog_gain(ar0234, ar0234->again->val);
+
+	if (ar0234->dgain->is_new)
+		ar0234_write(ar0234, AR0234_REG_DIGITAL_GAIN,
+			     ar0234->dgain->val, &ret);
+
+	/* The strobe follows the exposure it is latched with */
+	if (ar0234->flash_enable->is_new || ar0234->flash_delay->is_new ||
+	    ar0234->flash_polarity->is_new) {
+		u16 flash_val = (u8)ar0234->flash_delay->val;
+
+		if (ar0234->flash_enable->val)
+			flash_val |= AR0234_FLASH_ENABLE;
+		if (ar0234->flash_polarity->val)
+			flash_val |= AR0234_FLASH_INVERT;
+
+		ar0234_write(ar0234, AR0234_REG_LED_FLASH_CONTROL, flash_val,
+			     &ret);
+	}
+
+	ar0234_group_hold_end(ar0234, &ret);
+
+	return ret;
 }
 
-static int ar0234_stream_on(struct ar0234 *ar0234)
+/*
+ * Switch the sensor to the other register context on a frame boundary.
+ * Frame length and exposure of the new context are brought up to date and
+ * latched in the same grouped hold.
+ */
+static int ar0234_set_context(struct ar0234 *ar0234)
 {
+	const struct ar0234_mode *mode = ar0234_active_mode(ar0234);
+	bool context_b = ar0234->context->val == AR0234_CONTEXT_B;
 	int ret = 0;
-	int tm;
 
-	tm = (ar0234->hw_config.trigger_mode >= 0) ?
-		     ar0234->hw_config.trigger_mode :
-		     trigger_mode;
+	ar0234_group_hold_begin(ar0234, &ret);
 
-	if (tm == AR0234_TRIGGER_MODE_OFF) {
-		ret = ar0234_mode_select(ar0234, true);
-	} else {
-		u16 reset_val = AR0234_RESET_DEFAULT | AR0234_RESET_GPI_EN |
-				AR0234_RESET_FORCED_PLL_ON;
+	ar0234_write(ar0234,
+		     ar0234_context_reg(ar0234, AR0234_REG_FRAME_LENGTH_LINES),
+		     mode->height + ar0234->vblank->val - AR0234_FLL_OVERHEAD,
+		     &ret);
 
-		if (tm == AR0234_TRIGGER_MODE_SLAVE_SYNC) {
-			reset_val |= AR0234_RESET_STREAM;
-			ret = cci_write(ar0234->regmap, AR0234_REG_GRR_CONTROL1,
-					AR0234_GRR_SLAVE_SH_SYNC, NULL);
-		}
+	/* May clamp the exposure, which is then written by a nested call */
+	ar0234_adjust_exposure_range(ar0234);
+	ar0234_write(ar0234,
+		     ar0234_context_reg(ar0234, AR0234_REG_EXPOSURE_COARSE),
+		     ar0234->exposure->val, &ret);
+	ar0234_write(ar0234,
+		     ar0234_context_reg(ar0234, AR0234_REG_EXPOSURE_FINE),
+		     ar0234->exposure_fine->val, &ret);
 
-		cci_write(ar0234->regmap, AR0234_REG_RESET, reset_val, &ret);
-	}
+	ar0234_update_bits(ar0234, AR0234_REG_READ_MODE,
+			   AR0234_READ_MODE_BINNING,
+			   ar0234_mode_reg_val(mode, AR0234_REG_READ_MODE, 0),
+			   &ret);
+	ar0234_update_bits(ar0234, AR0234_REG_DIGITAL_TEST,
+			   AR0234_DIGITAL_TEST_CONTEXT_B,
+			   context_b ? AR0234_DIGITAL_TEST_CONTEXT_B : 0, &ret);
+
+	ar0234_group_hold_end(ar0234, &ret);
 
 	return ret;
 }
 
-static int ar0234_start_streaming(struct ar0234 *ar0234)
+/*
+ * Start streaming in a trigger mode, or switch a running stream to another
+ * one. The PLL is kept running in the trigger modes, so a switch takes
+ * neither a PLL nor a sensor reprogram.
+ */
+static int ar0234_set_trigger_mode(struct ar0234 *ar0234, int tm)
 {
-	struct device *dev = ar0234->dev;
+	u16 reset_val = AR0234_RESET_DEFAULT;
+	u16 grr_val = 0;
 	int ret;
 
-	ret = pm_runtime_resume_and_get(dev);
-	if (ret < 0)
-		return ret;
-
-	/* Reset */
-	ret = ar0234_soft_reset(ar0234);
-	if (ret < 0) {
-		dev_err(dev, "%s failed to reset\n", __func__);
-		return ret;
-	}
-
-	/* PLL and MIPI config */
-	ret = ar0234_reg_seq_write(ar0234->regmap,
-				   &ar0234->pll_config->regs_pll);
-	if (ret < 0) {
-		dev_err(dev, "%s failed to configure pll/mipi settings\n",
-			__func__);
-		return ret;
+	switch (tm) {
+	case AR0234_TRIGGER_MODE_EXTERNAL:
+		/* Standby with TRIG enabled, one frame per trigger */
+		reset_val |= AR0234_RESET_GPI_EN | AR0234_RESET_FORCED_PLL_ON;
+		break;
+	case AR0234_TRIGGER_MODE_SLAVE_SYNC:
+		reset_val |= AR0234_RESET_GPI_EN | AR0234_RESET_FORCED_PLL_ON |
+			     AR0234_RESET_STREAM;
+		grr_val = AR0234_GRR_SLAVE_SH_SYNC;
+		break;
+	default:
+		reset_val |= AR0234_RESET_STREAM;
+		break;
 	}
 
-	/* Configure lane count */
-	ret = cci_write(ar0234->regmap, AR0234_REG_SERIAL_FORMAT,
-			(0x0200 | ar0234->hw_config.num_data_lanes), NULL);
-	if (ret < 0) {
-		dev_err(dev, "%s failed to configure lane count\n", __func__);
-		return ret;
-	}
+	/* Also clears slave mode left over from a previous stream */
+	ret = ar0234_update_bits(ar0234, AR0234_REG_GRR_CONTROL1,
+				 AR0234_GRR_SLAVE_SH_SYNC, grr_val, NULL);
 
-	/* Common */
-	ret = cci_multi_reg_write(ar0234->regmap, common_init,
-				  ARRAY_SIZE(common_init), NULL);
-	if (ret < 0) {
-		dev_err(dev, "%s failed to set common settings\n", __func__);
-		return ret;
-	}
+	return cci_write(ar0234->regmap, AR0234_REG_RESET, reset_val, &ret);
+}
 
-	/* Configure recommended pixclk settings */
-	ret = ar0234_pixclk_config(ar0234);
-	if (ret < 0) {
-		dev_err(dev, "%s failed to apply recommended pixclk settings\n",
-			__func__);
-	}
+/*
+ * Capture one frame in external trigger mode without the TRIG pin. Streaming
+ * is turned on and right back off, the sensor completes the frame it has
+ * started before it returns to standby and waits for the next trigger.
+ */
+static int ar0234_software_trigger(struct ar0234 *ar0234)
+{
+	u16 reset_val = AR0234_RESET_DEFAULT | AR0234_RESET_GPI_EN |
+			AR0234_RESET_FORCED_PLL_ON;
+	int ret;
 
-	/* Apply default values of current frame format */
-	ret = ar0234_reg_seq_write(ar0234->regmap,
-				   &ar0234->cur_mode->reg_sequence);
-	if (ret < 0) {
-		dev_err(dev, "%s failed to set frame format\n", __func__);
-		return ret;
-	}
+	ret = cci_write(ar0234->regmap, AR0234_REG_RESET,
+			reset_val | AR0234_RESET_STREAM, NULL);
 
-	/* Configure flash output if enabled */
-	if (ar0234->hw_config.flash_enable) {
-		u16 flash_val = AR0234_FLASH_ENABLE |
-				(u8)ar0234->hw_config.flash_delay;
+	return cci_write(ar0234->regmap, AR0234_REG_RESET, reset_val, &ret);
+}
 
-		ret = cci_write(ar0234->regmap, AR0234_REG_LED_FLASH_CONTROL,
-				flash_val, NULL);
-		if (ret < 0) {
-			dev_err(dev, "%s failed to configure flash\n",
-				__func__);
-			return ret;
-		}
+/*
+ * Estimated delay from the TRIG rising edge to the start of integration, in
+ * ns. External trigger starts integration on the next line boundary, this
+ * is the worst case. In sync-sink mode the integration is placed at the end
+ * of the frame started by the trigger.
+ */
+static s32 ar0234_trigger_latency(struct ar0234 *ar0234)
+{
+	const struct ar0234_mode *mode = ar0234_active_mode(ar0234);
+	u32 pixclk = ar0234_freq_pixclk[ar0234->hw_config.lane_count_id];
+	u32 llp = ar0234_line_length_pck(ar0234, ar0234->hblank->val);
+	u32 fll = mode->height + ar0234->vblank->val - AR0234_FLL_OVERHEAD;
+	u64 line_ns = div_u64((u64)llp * NSEC_PER_SEC, pixclk);
+
+	switch (ar0234->trigger_mode->val) {
+	case AR0234_TRIGGER_MODE_EXTERNAL:
+		return line_ns;
+	case AR0234_TRIGGER_MODE_SLAVE_SYNC:
+		return min_t(u64, (fll - ar0234->exposure->val) * line_ns,
+			     S32_MAX);
 	}
 
-	/* Apply customized values from user */
-	ret = __v4l2_ctrl_handler_setup(ar0234->sd.ctrl_handler);
-	if (ret)
-		return ret;
-
-	ret = ar0234_stream_on(ar0234);
-
-	return ret;
+	return 0;
 }
 
-static void ar0234_stop_streaming(struct ar0234 *ar0234)
+static int ar0234_get_volatile_ctrl(struct v4l2_ctrl *ctrl)
 {
-	struct device *dev = ar0234->dev;
-	int ret;
+	struct ar0234 *ar0234 =
+		container_of(ctrl->handler, struct ar0234, ctrl_handler);
 
-	ret = cci_write(ar0234->regmap, AR0234_REG_RESET, AR0234_RESET_DEFAULT,
-			NULL);
-	if (ret < 0)
-		dev_err(dev, "%s failed to stop streaming\n", __func__);
+	switch (ctrl->id) {
+	case V4L2_CID_AR0234_TRIGGER_LATENCY:
+		ctrl->val = ar0234_trigger_latency(ar0234);
+		return 0;
+	case V4L2_CID_AR0234_SYNC_STREAM_ON_SKEW:
+		if (ar0234->sync_error)
+			return ar0234->sync_error;
+		ctrl->val = READ_ONCE(ar0234->sync_stream_on_skew_ns);
+		return 0;
+	case V4L2_CID_AR0234_TEMPERATURE:
+		/* Never touch the bus here, the last sample is good enough */
+		ctrl->val = READ_ONCE(ar0234->temperature);
+		return 0;
+	}
 
-	pm_runtime_mark_last_busy(dev);
-	pm_runtime_put_autosuspend(dev);
+	return -EINVAL;
 }
 
-static int ar0234_set_stream(struct v4l2_subdev *sd, int enable)
+/*
+ * Split an exposure time into whole lines and pixel clock cycles of fine
+ * integration. Lines start from the default HBLANK of the mode and are only
+ * stretched once the exposure no longer fits in the longest frame, VBLANK
+ * gives the shortest frame that holds it. The controls are set through the
+ * handler, the writes latch in one frame.
+ */
+static int ar0234_set_exposure_us(struct ar0234 *ar0234, u32 exposure_us)
 {
-	struct ar0234 *ar0234 = to_ar0234(sd);
+	/* HBLANK counts pixels of the format, VBLANK lines of the readout */
+	const struct ar0234_mode *mode = ar0234->cur_mode;
+	u32 height = ar0234_active_mode(ar0234)->height;
+	unsigned int ppc = ar0234_pixels_per_clk(mode);
+	u32 pixclk = ar0234_freq_pixclk[ar0234->hw_config.lane_count_id];
+	u64 total = div_u64((u64)exposure_us * pixclk, USEC_PER_SEC);
+	u32 line_length = ar0234_line_length_pck(ar0234,
+						 ar0234->hblank->default_value);
+	u32 lines, fine;
+	int vblank;
 	int ret = 0;
 
-	mutex_lock(&ar0234->mutex);
-	if (ar0234->streaming == enable) {
-		mutex_unlock(&ar0234->mutex);
+	/* Zero keeps the exposure set by the other controls */
+	if (!exposure_us)
 		return 0;
-	}
 
-	if (enable) {
-		ret = ar0234_start_streaming(ar0234);
-		if (ret)
-			goto err_start_streaming;
-	} else {
-		ar0234_stop_streaming(ar0234);
+	line_length = max_t(u32, line_length,
+			    DIV_ROUND_UP_ULL(total, AR0234_EXPOSURE_MAX));
+	line_length = min_t(u32, line_length, AR0234_LINE_LENGTH_PCK_MAX);
+
+	lines = min_t(u64, div_u64_rem(total, line_length, &fine),
+		      AR0234_EXPOSURE_MAX);
+	if (lines < AR0234_EXPOSURE_MIN) {
+		lines = AR0234_EXPOSURE_MIN;
+		fine = 0;
 	}
 
-	ar0234->streaming = enable;
+	if (ar0234->streaming)
+		ar0234_group_hold_begin(ar0234, &ret);
 
-	/* vflip and hflip cannot change during streaming */
-	__v4l2_ctrl_grab(ar0234->vflip, enable);
-	__v4l2_ctrl_grab(ar0234->hflip, enable);
+	ar0234->exposure_us_busy = true;
 
-	mutex_unlock(&ar0234->mutex);
+	if (!ret)
+		ret = __v4l2_ctrl_s_ctrl(ar0234->hblank,
+					 line_length * ppc - mode->width);
 
-	return ret;
+	vblank = max_t(int, lines + AR0234_FLL_OVERHEAD + 1 - height,
+		       ar0234->vblank->minimum);
+	if (!ret)
+		ret = __v4l2_ctrl_s_ctrl(ar0234->vblank, vblank);
+	if (!ret)
+		ret = __v4l2_ctrl_s_ctrl(ar0234->exposure, lines);
+	if (!ret)
+		ret = __v4l2_ctrl_s_ctrl(ar0234->exposure_fine, fine);
 
-err_start_streaming:
-	mutex_unlock(&ar0234->mutex);
+	ar0234->exposure_us_busy = false;
+
+	if (ar0234->streaming)
+		ar0234_group_hold_end(ar0234, &ret);
 
 	return ret;
 }
 
-/* Power/clock management functions */
-static int ar0234_power_on(struct device *dev)
+/* A direct write of an exposure control ends the exposure time setting */
+static void ar0234_exposure_us_override(struct ar0234 *ar0234,
+					struct v4l2_ctrl *ctrl)
 {
-	struct i2c_client *client = to_i2c_client(dev);
-	struct v4l2_subdev *sd = i2c_get_clientdata(client);
-	struct ar0234 *ar0234 = to_ar0234(sd);
+	if (ar0234->exposure_us_busy || !ar0234->exposure_us->val)
+		return;
+
+	/* The exposure cluster also carries VBLANK */
+	if (ctrl->id != V4L2_CID_EXPOSURE && ctrl->id != V4L2_CID_HBLANK)
+		return;
+
+	/* The control setup at stream start repeats the same values */
+	if (ctrl->val == ctrl->cur.val &&
+	    (ctrl->id != V4L2_CID_EXPOSURE ||
+	     (ar0234->exposure_fine->val == ar0234->exposure_fine->cur.val &&
+	      ar0234->vblank->val == ar0234->vblank->cur.val)))
+		return;
+
+	__v4l2_ctrl_s_ctrl(ar0234->exposure_us, 0);
+}
+
+static int __ar0234_set_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct ar0234 *ar0234 =
+		container_of(ctrl->handler, struct ar0234, ctrl_handler);
+	struct i2c_client *client = v4l2_get_subdevdata(&ar0234->sd);
+	/* Streaming holds a runtime PM reference until the stream stops */
+	bool pm_ref = !ar0234->streaming;
 	int ret;
 
-	ret = regulator_bulk_enable(AR0234_NUM_SUPPLIES,
-				    ar0234->hw_config.supplies);
-	if (ret) {
-		dev_err(dev, "%s: failed to enable regulators\n", __func__);
-		return ret;
+	/* Only sets other controls, which take care of the power state */
+	if (ctrl->id == V4L2_CID_AR0234_EXPOSURE_US)
+		return ar0234_set_exposure_us(ar0234, ctrl->val);
+
+	ar0234_exposure_us_override(ar0234, ctrl);
+
+	/*
+	 * A hold needs a running stream. The control setup at stream start
+	 * never opens one, the stream stop has cleared the control.
+	 */
+	if (ctrl->id == V4L2_CID_AR0234_GROUP_HOLD && !ar0234->streaming)
+		return ctrl->val ? -EBUSY : 0;
+
+	/*
+	 * Applying V4L2 control value only happens when power is up for
+	 * streaming, and not while stream start programs the sensor. The
+	 * control setup at the end of it applies the value.
+	 */
+	if (ar0234->init_running ||
+	    (pm_ref && pm_runtime_get_if_in_use(&client->dev) == 0)) {
+		if (ctrl->id == V4L2_CID_AR0234_CONTEXT)
+			ar0234_adjust_exposure_range(ar0234);
+		else if (ctrl->id == V4L2_CID_HBLANK)
+			ar0234_adjust_exposure_fine_range(ar0234);
+
+		/* There is no frame to capture */
+		if (ctrl->id == V4L2_CID_AR0234_SOFTWARE_TRIGGER)
+			return -EBUSY;
+
+		return 0;
 	}
 
-	ret = clk_prepare_enable(ar0234->hw_config.extclk);
-	if (ret) {
-		dev_err(dev, "%s: failed to enable clock\n", __func__);
-		goto reg_off;
+	/* The sync group did not start this sensor, see ar0234_sync_fail() */
+	if (ar0234->sync_error) {
+		ret = ar0234->sync_error;
+		goto pm_put;
 	}
 
-	gpiod_set_value_cansleep(ar0234->hw_config.gpio_reset, 1);
-	usleep_range(AR0234_RESET_DELAY_MIN_US,
-		     AR0234_RESET_DELAY_MIN_US + AR0234_RESET_DELAY_RANGE_US);
+	switch (ctrl->id) {
+	case V4L2_CID_EXPOSURE:
+		/* Cluster master, also covers analogue and digital gain */
+		ret = ar0234_set_exposure_cluster(ar0234);
+		break;
+	case V4L2_CID_TEST_PATTERN:
+		ret = ar0234_write(ar0234, AR0234_REG_TEST_PATTERN_MODE,
+				   ar0234_test_pattern_val[ctrl->val], NULL);
+		break;
+	case V4L2_CID_TEST_PATTERN_RED:
+		ret = ar0234_write(ar0234, AR0234_REG_TEST_DATA_RED, ctrl->val,
+				   NULL);
+		break;
+	case V4L2_CID_TEST_PATTERN_GREENR:
+		ret = ar0234_write(ar0234, AR0234_REG_TEST_DATA_GREENR,
+				   ctrl->val, NULL);
+		break;
+	case V4L2_CID_TEST_PATTERN_BLUE:
+		ret = ar0234_write(ar0234, AR0234_REG_TEST_DATA_BLUE, ctrl->val,
+				   NULL);
+		break;
+	case V4L2_CID_TEST_PATTERN_GREENB:
+		ret = ar0234_write(ar0234, AR0234_REG_TEST_DATA_GREENB,
+				   ctrl->val, NULL);
+		break;
+	case V4L2_CID_HFLIP:
+	case V4L2_CID_VFLIP:
+		ret = ar0234_write(ar0234, AR0234_REG_IMAGE_ORIENTATION,
+				   (ar0234->vflip->val << 1) |
+					   ar0234->hflip->val,
+				   NULL);
+		break;
+	case V4L2_CID_LINK_FREQ:
+	case V4L2_CID_PIXEL_RATE:
+		/* Follow the format, applied on the next stream start */
+		ret = 0;
+		break;
+	case V4L2_CID_AR0234_CONTEXT:
+		ret = ar0234_set_context(ar0234);
+		break;
+	case V4L2_CID_AR0234_CONTEXT_B_MODE:
+		/* The context being read out cannot be reprogrammed */
+		if (ar0234->streaming &&
+		    ar0234->context->val == AR0234_CONTEXT_B) {
+			ret = -EBUSY;
+			break;
+		}
 
-	return 0;
+		ret = ar0234_context_b_preload(ar0234);
+		break;
+	case V4L2_CID_AR0234_TRIGGER_MODE:
+		/* Otherwise applied on stream start */
+		ret = 0;
+		if (ar0234->streaming)
+			ret = ar0234_set_trigger_mode(ar0234, ctrl->val);
+		break;
+	case V4L2_CID_AR0234_SOFTWARE_TRIGGER:
+		/* Only a sensor waiting for triggers can take one */
+		if (!ar0234->streaming ||
+		    ar0234->trigger_mode->val != AR0234_TRIGGER_MODE_EXTERNAL) {
+			ret = -EBUSY;
+			break;
+		}
 
-reg_off:
-	regulator_bulk_disable(AR0234_NUM_SUPPLIES, ar0234->hw_config.supplies);
+		ret = ar0234_software_trigger(ar0234);
+		break;
+	case V4L2_CID_AR0234_SYNC_GROUP:
+		/* Looked up on stream start */
+		ret = 0;
+		break;
+	case V4L2_CID_AR0234_GROUP_HOLD:
+		/*
+		 * Writes up to the release are latched on one frame start.
+		 * The stream stop releases a hold left open.
+		 */
+		ret = 0;
+		if (ctrl->val == ar0234->user_hold)
+			break;
+
+		if (ctrl->val)
+			ar0234_group_hold_begin(ar0234, &ret);
+		else
+			ar0234_group_hold_end(ar0234, &ret);
+		ar0234->user_hold = ctrl->val;
+		break;
+	case V4L2_CID_HBLANK:
+		/*
+		 * Shorter lines may clamp the fine integration, which is
+		 * written by a nested call. Keep both in the same frame.
+		 */
+		ret = 0;
+		ar0234_group_hold_begin(ar0234, &ret);
+		ar0234_adjust_exposure_fine_range(ar0234);
+		ar0234_write(ar0234, AR0234_REG_LINE_LENGTH_PCK,
+			     ar0234_line_length_pck(ar0234, ctrl->val), &ret);
+		ar0234_group_hold_end(ar0234, &ret);
+		break;
+	default:
+		dev_info(&client->dev,
+			 "ctrl(id:0x%x,val:0x%x) is not handled\n", ctrl->id,
+			 ctrl->val);
+		ret = -EINVAL;
+		break;
+	}
+
+pm_put:
+	if (pm_ref) {
+		pm_runtime_mark_last_busy(&client->dev);
+		pm_runtime_put_autosuspend(&client->dev);
+	}
 
 	return ret;
 }
 
-static int ar0234_power_off(struct device *dev)
+static int ar0234_set_ctrl(struct v4l2_ctrl *ctrl)
 {
-	struct i2c_client *client = to_i2c_client(dev);
-	struct v4l2_subdev *sd = i2c_get_clientdata(client);
-	struct ar0234 *ar0234 = to_ar0234(sd);
+	struct ar0234 *ar0234 =
+		container_of(ctrl->handler, struct ar0234, ctrl_handler);
+	struct ar0234_phase_timer timer;
+	u64 duration;
+	int ret;
 
-	gpiod_set_value_cansleep(ar0234->hw_config.gpio_reset, 0);
-	regulator_bulk_disable(AR0234_NUM_SUPPLIES, ar0234->hw_config.supplies);
-	clk_disable_unprepare(ar0234->hw_config.extclk);
+	ar0234_phase_begin(ar0234, AR0234_PHASE_CTRL, &timer);
+	ret = __ar0234_set_ctrl(ctrl);
+	duration = ar0234_phase_end(ar0234, AR0234_PHASE_CTRL, &timer, ret);
+
+	trace_ar0234_ctrl_write(ar0234->dev, ctrl->id, ctrl->val, duration,
+				ret);
+
+	return ret;
+}
+
+/*
+ * Clamp the exposure to a frame length set in the same call, so that both
+ * are written together by the cluster.
+ */
+static int ar0234_try_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct ar0234 *ar0234 =
+		container_of(ctrl->handler, struct ar0234, ctrl_handler);
+
+	if (ctrl->id == V4L2_CID_EXPOSURE && ar0234->vblank->is_new)
+		ar0234->exposure->val =
+			min(ar0234->exposure->val,
+			    ar0234_exposure_max(ar0234, ar0234->vblank->val));
 
 	return 0;
 }
 
-/* Verify chip ID */
-static int ar0234_identify_module(struct ar0234 *ar0234)
+/* Exposure limits follow VBLANK once the cluster is committed */
+static void ar0234_vblank_notify(struct v4l2_ctrl *ctrl, void *priv)
 {
-	int ret;
-	u64 reg_val;
+	ar0234_adjust_exposure_range(priv);
+}
 
-	ret = cci_read(ar0234->regmap, AR0234_REG_CHIP_ID, &reg_val, NULL);
-	if (ret < 0)
-		return dev_err_probe(ar0234->dev, ret,
-				     "failed to read chip id\n");
+static const struct v4l2_ctrl_ops ar0234_ctrl_ops = {
+	.g_volatile_ctrl = ar0234_get_volatile_ctrl,
+	.try_ctrl = ar0234_try_ctrl,
+	.s_ctrl = ar0234_set_ctrl,
+};
 
-	if (reg_val == AR0234_CHIP_ID_MONO)
-		ar0234->monochrome = true;
-	else if (reg_val != AR0234_CHIP_ID)
-		return dev_err_probe(ar0234->dev, -EIO,
-				     "Invalid chip id: 0x%x\n", (u16)reg_val);
+static const struct v4l2_ctrl_config ar0234_ctrl_context_b_mode = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_CONTEXT_B_MODE,
+	.name = "Context B Mode",
+	.type = V4L2_CTRL_TYPE_MENU,
+	/* 2x2 binned preview */
+	.def = AR0234_MODE_BINNED_PREVIEW,
+};
 
-	dev_info(ar0234->dev, "Success reading chip id: 0x%x\n", (u16)reg_val);
+static const struct v4l2_ctrl_config ar0234_ctrl_context = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_CONTEXT,
+	.name = "Sensor Context",
+	.type = V4L2_CTRL_TYPE_MENU,
+	.max = ARRAY_SIZE(ar0234_context_menu) - 1,
+	.def = AR0234_CONTEXT_A,
+	.qmenu = ar0234_context_menu,
+};
 
-	return ret;
-}
+static const struct v4l2_ctrl_config ar0234_ctrl_trigger_mode = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_TRIGGER_MODE,
+	.name = "Trigger Mode",
+	.type = V4L2_CTRL_TYPE_MENU,
+	.max = ARRAY_SIZE(ar0234_trigger_mode_menu) - 1,
+	.def = AR0234_TRIGGER_MODE_OFF,
+	.qmenu = ar0234_trigger_mode_menu,
+};
 
-static const struct v4l2_subdev_core_ops ar0234_core_ops = {
-	.subscribe_event = v4l2_ctrl_subdev_subscribe_event,
-	.unsubscribe_event = v4l2_event_subdev_unsubscribe,
+static const struct v4l2_ctrl_config ar0234_ctrl_trigger_latency = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_TRIGGER_LATENCY,
+	.name = "Trigger Latency ns",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.max = S32_MAX,
+	.step = 1,
 };
 
-static const struct v4l2_subdev_video_ops ar0234_video_ops = {
-	.s_stream = ar0234_set_stream,
+static const struct v4l2_ctrl_config ar0234_ctrl_temperature = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_TEMPERATURE,
+	.name = "Temperature mC",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min = AR0234_TEMP_MIN_MC,
+	.max = AR0234_TEMP_MAX_MC,
+	.step = 1,
 };
 
-static const struct v4l2_subdev_pad_ops ar0234_pad_ops = {
-	.enum_mbus_code = ar0234_enum_mbus_code,
-	.get_fmt = ar0234_get_pad_format,
-	.set_fmt = ar0234_set_pad_format,
-	.get_selection = ar0234_get_selection,
-	.enum_frame_size = ar0234_enum_frame_size,
+static const struct v4l2_ctrl_config ar0234_ctrl_group_hold = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_GROUP_HOLD,
+	.name = "Group Hold",
+	.type = V4L2_CTRL_TYPE_BOOLEAN,
+	.max = 1,
+	.step = 1,
 };
 
-static const struct v4l2_subdev_ops ar0234_subdev_ops = {
-	.core = &ar0234_core_ops,
-	.video = &ar0234_video_ops,
-	.pad = &ar0234_pad_ops,
+/* Constant, the ID, name and value are filled in from ar0234_ctrl_delays */
+static const struct v4l2_ctrl_config ar0234_ctrl_delay = {
+	.ops = &ar0234_ctrl_ops,
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY,
+	.step = 1,
 };
 
-static const struct v4l2_subdev_internal_ops ar0234_internal_ops = {
-	.open = ar0234_open,
+static const struct {
+	u32 id;
+	const char *name;
+	s64 frames;
+} ar0234_ctrl_delays[] = {
+	{ V4L2_CID_AR0234_EXPOSURE_DELAY, "Exposure Delay Frames",
+	  AR0234_EXPOSURE_DELAY },
+	{ V4L2_CID_AR0234_GAIN_DELAY, "Gain Delay Frames", AR0234_GAIN_DELAY },
+	{ V4L2_CID_AR0234_VBLANK_DELAY, "Vertical Blanking Delay Frames",
+	  AR0234_VBLANK_DELAY },
 };
 
-/* Initialize control handlers */
-static int ar0234_init_controls(struct ar0234 *ar0234)
+static const struct v4l2_ctrl_config ar0234_ctrl_sync_group = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_SYNC_GROUP,
+	.name = "Sync Group",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.max = AR0234_SYNC_GROUP_MAX,
+	.step = 1,
+};
+
+static const struct v4l2_ctrl_config ar0234_ctrl_sync_stream_on_skew = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_SYNC_STREAM_ON_SKEW,
+	.name = "Sync Stream On Skew ns",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.max = S32_MAX,
+	.step = 1,
+};
+
+static const char *const ar0234_flash_polarity_menu[] = {
+	"Active High",
+	"Active Low",
+};
+
+static const struct v4l2_ctrl_config ar0234_ctrl_flash_enable = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_FLASH_ENABLE,
+	.name = "Flash Enable",
+	.type = V4L2_CTRL_TYPE_BOOLEAN,
+	.max = 1,
+	.step = 1,
+};
+
+static const struct v4l2_ctrl_config ar0234_ctrl_flash_delay = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_FLASH_DELAY,
+	.name = "Flash Delay",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = -AR0234_FLASH_DELAY_MAX,
+	.max = AR0234_FLASH_DELAY_MAX,
+	.step = 1,
+};
+
+static const struct v4l2_ctrl_config ar0234_ctrl_flash_polarity = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_FLASH_POLARITY,
+	.name = "Flash Polarity",
+	.type = V4L2_CTRL_TYPE_MENU,
+	.max = ARRAY_SIZE(ar0234_flash_polarity_menu) - 1,
+	.qmenu = ar0234_flash_polarity_menu,
+};
+
+static const struct v4l2_ctrl_config ar0234_ctrl_exposure_fine = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_EXPOSURE_FINE,
+	.name = "Exposure Fine",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.max = AR0234_LINE_LENGTH_PCK_MAX - 1,
+	.step = 1,
+};
+
+/* The maximum follows the pixel clock */
+static const struct v4l2_ctrl_config ar0234_ctrl_exposure_us = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_EXPOSURE_US,
+	.name = "Exposure Time us",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.step = 1,
+};
+
+static const struct v4l2_ctrl_config ar0234_ctrl_software_trigger = {
+	.ops = &ar0234_ctrl_ops,
+	.id = V4L2_CID_AR0234_SOFTWARE_TRIGGER,
+	.name = "Software Trigger",
+	.type = V4L2_CTRL_TYPE_BUTTON,
+};
+
+static int ar0234_enum_mbus_code(struct v4l2_subdev *sd,
+				 struct v4l2_subdev_state *sd_state,
+				 struct v4l2_subdev_mbus_code_enum *code)
 {
-	struct i2c_client *client = v4l2_get_subdevdata(&ar0234->sd);
-	struct v4l2_fwnode_device_properties props;
-	struct v4l2_ctrl_handler *ctrl_hdlr;
-	struct v4l2_ctrl *ctrl;
-	unsigned int pixel_rate;
-	int i, ret;
+	struct ar0234 *ar0234 = to_ar0234(sd);
+	const struct ar0234_pll_config *pll_config;
+
+	if (code->pad >= NUM_PADS)
+		return -EINVAL;
+
+	if (code->pad == IMAGE_PAD) {
+		if (code->index >= ar0234->num_pll_configs)
+			return -EINVAL;
+
+		pll_config = ar0234->pll_configs[code->index];
+		code->code = ar0234_pll_format_code(ar0234, pll_config);
+	} else {
+		if (code->index > 0)
+			return -EINVAL;
+
+		code->code = MEDIA_BUS_FMT_SENSOR_DATA;
+	}
+
+	return 0;
+}
+
+static int ar0234_enum_frame_size(struct v4l2_subdev *sd,
+				  struct v4l2_subdev_state *sd_state,
+				  struct v4l2_subdev_frame_size_enum *fse)
+{
+	struct ar0234 *ar0234 = to_ar0234(sd);
+	const struct v4l2_mbus_framefmt *fmt;
+
+	if (fse->pad >= NUM_PADS)
+		return -EINVAL;
+
+	if (fse->pad == IMAGE_PAD) {
+		if (fse->index >= ar0234->num_modes)
+			return -EINVAL;
+
+		if (ar0234_find_pll_config(ar0234, fse->code) < 0)
+			return -EINVAL;
+
+		fse->min_width = ar0234->modes[fse->index].width;
+		fse->max_width = fse->min_width;
+		fse->min_height = ar0234->modes[fse->index].height;
+		fse->max_height = fse->min_height;
+	} else {
+		if (fse->code != MEDIA_BUS_FMT_SENSOR_DATA || fse->index > 0)
+			return -EINVAL;
+
+		/* Sized by the bit depth of the image pad format */
+		fmt = v4l2_subdev_state_get_format(sd_state, METADATA_PAD);
+		fse->min_width = fmt->width;
+		fse->max_width = fse->min_width;
+		fse->min_height = fmt->height;
+		fse->max_height = fse->min_height;
+	}
+
+	return 0;
+}
+
+static void ar0234_reset_colorspace(struct v4l2_mbus_framefmt *fmt)
+{
+	fmt->colorspace = V4L2_COLORSPACE_SRGB;
+	fmt->ycbcr_enc = V4L2_MAP_YCBCR_ENC_DEFAULT(fmt->colorspace);
+	fmt->quantization = V4L2_MAP_QUANTIZATION_DEFAULT(true, fmt->colorspace,
+							  fmt->ycbcr_enc);
+	fmt->xfer_func = V4L2_MAP_XFER_FUNC_DEFAULT(fmt->colorspace);
+}
+
+static void ar0234_update_image_pad_format(const struct ar0234_mode *mode,
+					   u32 code,
+					   struct v4l2_mbus_framefmt *fmt)
+{
+	fmt->code = code;
+	fmt->width = mode->width;
+	fmt->height = mode->height;
+	fmt->field = V4L2_FIELD_NONE;
+	ar0234_reset_colorspace(fmt);
+}
+
+static void
+ar0234_update_metadata_pad_format(const struct ar0234_pll_config *pll_config,
+				  struct v4l2_mbus_framefmt *fmt)
+{
+	fmt->width = ar0234_metadata_line_width(pll_config);
+	fmt->height = AR0234_NUM_METADATA_LINES;
+	fmt->code = MEDIA_BUS_FMT_SENSOR_DATA;
+	fmt->field = V4L2_FIELD_NONE;
+}
+
+static int ar0234_init_state(struct v4l2_subdev *sd,
+			     struct v4l2_subdev_state *state)
+{
+	struct ar0234 *ar0234 = to_ar0234(sd);
+	const struct ar0234_pll_config *pll_config = ar0234->pll_configs[0];
+	const struct ar0234_mode *mode = &ar0234->modes[0];
+	struct v4l2_mbus_framefmt *fmt;
+
+	fmt = v4l2_subdev_state_get_format(state, IMAGE_PAD);
+	ar0234_update_image_pad_format(mode,
+				       ar0234_pll_format_code(ar0234,
+							      pll_config),
+				       fmt);
+	*v4l2_subdev_state_get_crop(state, IMAGE_PAD) = mode->crop;
+
+	fmt = v4l2_subdev_state_get_format(state, METADATA_PAD);
+	ar0234_update_metadata_pad_format(pll_config, fmt);
+
+	return 0;
+}
+
+/*
+ * Shortest line, in pixel clock cycles, that still fits the line data on
+ * the MIPI link. Sub-sampled modes are bound by the full crop width.
+ */
+static u32 ar0234_line_length_min(struct ar0234 *ar0234,
+				  const struct ar0234_mode *mode)
+{
+	u64 bits = (u64)mode->crop.width * ar0234->pll_config->bit_depth *
+		   ar0234_freq_pixclk[ar0234->hw_config.lane_count_id];
+	u64 link_rate = (u64)ar0234->pll_config->freq_link * 2 *
+			ar0234->hw_config.num_data_lanes;
+
+	return div64_u64(bits + link_rate - 1, link_rate) +
+	       AR0234_LINE_BLANKING_MIN;
+}
+
+static void ar0234_set_framing_limits(struct ar0234 *ar0234)
+{
+	int hblank_min, hblank_max, hblank;
+	const struct ar0234_mode *mode = ar0234->cur_mode;
+	unsigned int ppc = ar0234_pixels_per_clk(mode);
+	s64 pixel_rate;
+
+	/* HBLANK and PIXEL_RATE count output pixels of this mode */
+	pixel_rate = (s64)ar0234_freq_pixclk[ar0234->hw_config.lane_count_id] *
+		     ppc;
+	__v4l2_ctrl_modify_range(ar0234->pixel_rate, pixel_rate, pixel_rate, 1,
+				 pixel_rate);
+
+	/* Update limits and set FPS to default */
+	__v4l2_ctrl_modify_range(ar0234->vblank, AR0234_VBLANK_MIN,
+				 AR0234_FLL_MAX - mode->height,
+				 ar0234->vblank->step, AR0234_VBLANK_MIN);
+
+	/* Setting this will adjust the exposure limits as well */
+	__v4l2_ctrl_s_ctrl(ar0234->vblank, AR0234_VBLANK_MIN);
+	/* Unless it was already set, the height may still have changed */
+	ar0234_adjust_exposure_range(ar0234);
+
+	/*
+	 * Default to the full width line time of the fixed modes. The step
+	 * keeps LINE_LENGTH_PCK a whole number of pixel clock cycles.
+	 */
+	hblank_min = ar0234_line_length_min(ar0234, mode) * ppc - mode->width;
+	hblank_max = AR0234_LINE_LENGTH_PCK_MAX * ppc - mode->width;
+	hblank = max_t(int, AR0234_LINE_LENGTH_PCK_DEF * ppc - mode->width,
+		       hblank_min);
+	__v4l2_ctrl_modify_range(ar0234->hblank, hblank_min, hblank_max, ppc,
+				 hblank);
+	__v4l2_ctrl_s_ctrl(ar0234->hblank, hblank);
+
+	/* The line length also follows the mode when HBLANK is unchanged */
+	ar0234_adjust_exposure_fine_range(ar0234);
+}
+
+static int ar0234_set_active_format(struct ar0234 *ar0234,
+				    const struct ar0234_mode *mode,
+				    unsigned int pll_index)
+{
+	const struct ar0234_pll_config *pll_config =
+		ar0234->pll_configs[pll_index];
+
+	if (ar0234->streaming)
+		return -EBUSY;
+
+	mutex_lock(ar0234->ctrl_handler.lock);
+
+	ar0234->cur_mode = mode;
+
+	if (ar0234->pll_config != pll_config) {
+		ar0234->pll_config = pll_config;
+		/* Programmed by a full sensor init */
+		ar0234->reset_needed = true;
+		__v4l2_ctrl_s_ctrl(ar0234->link_freq, pll_index);
+	}
+
+	ar0234_set_framing_limits(ar0234);
+
+	mutex_unlock(ar0234->ctrl_handler.lock);
+
+	return 0;
+}
+
+static int ar0234_set_pad_format(struct v4l2_subdev *sd,
+				 struct v4l2_subdev_state *sd_state,
+				 struct v4l2_subdev_format *fmt)
+{
+	struct ar0234 *ar0234 = to_ar0234(sd);
+	const struct ar0234_pll_config *pll_config;
+	const struct ar0234_mode *mode;
+	struct v4l2_mbus_framefmt *framefmt;
+	int pll_index;
+	int ret;
+
+	if (fmt->pad >= NUM_PADS)
+		return -EINVAL;
+
+	/* Only one embedded data mode, it follows the image pad */
+	if (fmt->pad == METADATA_PAD)
+		return v4l2_subdev_get_fmt(sd, sd_state, fmt);
+
+	framefmt = v4l2_subdev_state_get_format(sd_state, IMAGE_PAD);
+
+	/* Bit depth and link frequency follow the code */
+	pll_index = ar0234_find_pll_config(ar0234, fmt->format.code);
+	if (pll_index < 0)
+		pll_index = ar0234_find_pll_config(ar0234, framefmt->code);
+	pll_config = ar0234->pll_configs[pll_index];
+
+	/* Keep a selected crop when its size is requested */
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE &&
+	    ar0234->cur_mode == &ar0234->roi_mode &&
+	    fmt->format.width == ar0234->roi_mode.width &&
+	    fmt->format.height == ar0234->roi_mode.height)
+		mode = &ar0234->roi_mode;
+	else
+		mode = v4l2_find_nearest_size(ar0234->modes,
+					      ar0234->num_modes, width, height,
+					      fmt->format.width,
+					      fmt->format.height);
+
+	if (fmt->which == V4L2_SUBDEV_FORMAT_ACTIVE &&
+	    (ar0234->cur_mode != mode || ar0234->pll_config != pll_config)) {
+		ret = ar0234_set_active_format(ar0234, mode, pll_index);
+		if (ret)
+			return ret;
+	}
+
+	ar0234_update_image_pad_format(mode,
+				       ar0234_pll_format_code(ar0234,
+							      pll_config),
+				       &fmt->format);
+	*framefmt = fmt->format;
+	*v4l2_subdev_state_get_crop(sd_state, IMAGE_PAD) = mode->crop;
+
+	/* Metadata lines are packed at the image bit depth */
+	framefmt = v4l2_subdev_state_get_format(sd_state, METADATA_PAD);
+	ar0234_update_metadata_pad_format(pll_config, framefmt);
+
+	return 0;
+}
+
+static int ar0234_get_selection(struct v4l2_subdev *sd,
+				struct v4l2_subdev_state *sd_state,
+				struct v4l2_subdev_selection *sel)
+{
+	switch (sel->target) {
+	case V4L2_SEL_TGT_CROP:
+		sel->r = *v4l2_subdev_state_get_crop(sd_state, sel->pad);
+
+		return 0;
+
+	case V4L2_SEL_TGT_NATIVE_SIZE:
+		sel->r.top = 0;
+		sel->r.left = 0;
+		sel->r.width = AR0234_NATIVE_WIDTH;
+		sel->r.height = AR0234_NATIVE_HEIGHT;
+
+		return 0;
+
+	case V4L2_SEL_TGT_CROP_DEFAULT:
+	case V4L2_SEL_TGT_CROP_BOUNDS:
+		sel->r.top = AR0234_PIXEL_ARRAY_TOP;
+		sel->r.left = AR0234_PIXEL_ARRAY_LEFT;
+		sel->r.width = AR0234_PIXEL_ARRAY_WIDTH;
+		sel->r.height = AR0234_PIXEL_ARRAY_HEIGHT;
+
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static int ar0234_set_selection(struct v4l2_subdev *sd,
+				struct v4l2_subdev_state *sd_state,
+				struct v4l2_subdev_selection *sel)
+{
+	struct ar0234 *ar0234 = to_ar0234(sd);
+	struct v4l2_mbus_framefmt *framefmt;
+
+	if (sel->target != V4L2_SEL_TGT_CROP || sel->pad != IMAGE_PAD)
+		return -EINVAL;
+
+	ar0234_adjust_crop(&sel->r);
+
+	if (sel->which == V4L2_SUBDEV_FORMAT_ACTIVE) {
+		if (ar0234->streaming)
+			return -EBUSY;
+
+		mutex_lock(ar0234->ctrl_handler.lock);
+
+		ar0234_set_roi_mode(ar0234, &sel->r);
+		ar0234->cur_mode = &ar0234->roi_mode;
+
+		/* Fewer rows allow a shorter frame, VBLANK range follows */
+		ar0234_set_framing_limits(ar0234);
+
+		mutex_unlock(ar0234->ctrl_handler.lock);
+	}
+
+	*v4l2_subdev_state_get_crop(sd_state, sel->pad) = sel->r;
+
+	/* No scaling, the output size follows the crop */
+	framefmt = v4l2_subdev_state_get_format(sd_state, sel->pad);
+	framefmt->width = sel->r.width;
+	framefmt->height = sel->r.height;
+
+	return 0;
+}
+
+/* Internal initialization starts now, its length follows the EXTCLK rate */
+static void ar0234_set_ready_time(struct ar0234 *ar0234)
+{
+	u32 delay_us = DIV_ROUND_UP_ULL((u64)AR0234_RESET_DELAY_CYCLES *
+						USEC_PER_SEC,
+					ar0234->hw_config.extclk_frequency);
+
+	ar0234->ready_time = ktime_add_us(ktime_get(), delay_us);
+}
+
+/* Wait for what is left of the internal initialization after a reset */
+static void ar0234_wait_ready(struct ar0234 *ar0234)
+{
+	s64 remaining_us = ktime_us_delta(ar0234->ready_time, ktime_get());
+
+	if (remaining_us > 0)
+		fsleep(remaining_us);
+}
+
+static int ar0234_soft_reset(struct ar0234 *ar0234)
+{
+	int ret;
+
+	ret = cci_write(ar0234->regmap, AR0234_REG_RESET, 0x0001, NULL);
+	if (ret)
+		return ret;
+
+	ar0234_set_ready_time(ar0234);
+	ar0234_wait_ready(ar0234);
+
+	return cci_write(ar0234->regmap, AR0234_REG_RESET, AR0234_RESET_DEFAULT,
+			 NULL);
+}
+
+/* MFR_30BA value programmed by the full init, before any analog gain */
+static u16 ar0234_mfr_30ba_init(struct ar0234 *ar0234)
+{
+	if (ar0234_freq_pixclk[ar0234->hw_config.lane_count_id] ==
+	    AR0234_FREQ_PIXCLK_45MHZ)
+		return AR0234_MFR_30BA_GAIN_BITS(6);
+
+	return AR0234_MFR_30BA_DEFAULT;
+}
+
+/* Precompiled init list of the current PLL config */
+static const struct ar0234_reg_sequence *
+ar0234_init_seq(struct ar0234 *ar0234)
+{
+	unsigned int i;
+
+	for (i = 0; i < ar0234->num_pll_configs; i++) {
+		if (ar0234->pll_configs[i] == ar0234->pll_config)
+			return &ar0234->init_seqs[i];
+	}
+
+	return &ar0234->init_seqs[0];
+}
+
+static inline int ar0234_mode_select(struct ar0234 *ar0234, bool stream_on)
+{
+	return cci_write(ar0234->regmap, AR0234_REG_MODE_SELECT, stream_on,
+			 NULL);
+}
+
+static int ar0234_stream_on(struct ar0234 *ar0234)
+{
+	lockdep_assert_held(ar0234->ctrl_handler.lock);
+
+	return ar0234_set_trigger_mode(ar0234, ar0234->trigger_mode->val);
+}
+
+/*
+ * The stream of @ar0234 was started by its enable_streams call already, and
+ * stays up until stopped. Its controls fail with the error meanwhile.
+ */
+static void ar0234_sync_fail(struct ar0234 *ar0234, int err)
+{
+	mutex_lock(ar0234->ctrl_handler.lock);
+	ar0234->sync_error = err;
+	mutex_unlock(ar0234->ctrl_handler.lock);
+}
+
+/* Stream on any sensor of the group, under its own register lock */
+static int ar0234_stream_on_locked(struct ar0234 *ar0234)
+{
+	int ret;
+
+	mutex_lock(ar0234->ctrl_handler.lock);
+
+	ret = ar0234_stream_on(ar0234);
+	/* The register cache can no longer be trusted */
+	if (ret)
+		ar0234->reset_needed = true;
+
+	mutex_unlock(ar0234->ctrl_handler.lock);
+
+	return ret;
+}
+
+/* Reset and set up everything that does not depend on the frame format */
+static int ar0234_sensor_init(struct ar0234 *ar0234)
+{
+	struct device *dev = ar0234->dev;
+	struct ar0234_phase_timer timer;
+	int ret = 0;
+
+	ar0234_phase_begin(ar0234, AR0234_PHASE_RESET, &timer);
+
+	ar0234_wait_ready(ar0234);
+
+	/* All registers are back to their defaults after either reset */
+	regcache_drop_region(ar0234->regmap, 0, AR0234_REG_ADDRESS_MAX);
+
+	/* Reset, unless the sensor just left a hardware reset */
+	if (!ar0234->hw_reset)
+		ret = ar0234_soft_reset(ar0234);
+
+	ar0234_phase_end(ar0234, AR0234_PHASE_RESET, &timer, ret);
+	if (ret < 0) {
+		dev_err(dev, "%s failed to reset\n", __func__);
+		return ret;
+	}
+
+	/* Anything programmed from here on is undone by a soft reset only */
+	ar0234->hw_reset = false;
+
+	/* PLL, lane count, common and pixclk settings in one pass */
+	ar0234_phase_begin(ar0234, AR0234_PHASE_INIT, &timer);
+	ret = ar0234_reg_seq_write(ar0234, ar0234_init_seq(ar0234));
+	/* Tuning written through debugfs survives power cycles */
+	if (!ret)
+		ret = ar0234_write_regs(ar0234, ar0234->reg_patch,
+					ar0234->num_reg_patch);
+	ar0234_phase_end(ar0234, AR0234_PHASE_INIT, &timer, ret);
+	if (ret < 0) {
+		dev_err(dev, "%s failed to write init settings\n", __func__);
+		return ret;
+	}
+
+	ar0234->mfr_30ba = ar0234_mfr_30ba_init(ar0234);
+
+	return 0;
+}
+
+/* Embedded data and statistics lines, latched on the next frame */
+static int ar0234_set_metadata(struct ar0234 *ar0234, bool enable)
+{
+	u16 mask = AR0234_SMIA_TEST_EMBEDDED_DATA |
+		   AR0234_SMIA_TEST_EMBEDDED_STATS;
+
+	return ar0234_update_bits(ar0234, AR0234_REG_SMIA_TEST, mask,
+				  enable ? mask : 0, NULL);
+}
+
+/* All probed sensors, sync groups are formed among them in probe order */
+static LIST_HEAD(ar0234_devices);
+static DEFINE_MUTEX(ar0234_devices_lock);
+
+/*
+ * Switch on an armed member of the sync group started by @ar0234. Errors of
+ * other members are reported by them, see ar0234_sync_fail().
+ */
+static int ar0234_sync_start_member(struct ar0234 *ar0234,
+				    struct ar0234 *member, u32 group,
+				    ktime_t *first)
+{
+	ktime_t now;
+	s64 skew;
+	int ret;
+
+	member->sync_armed = false;
+
+	ret = ar0234_stream_on_locked(member);
+	now = ktime_get();
+	if (ret) {
+		dev_err(member->dev, "failed to start sync group %u\n", group);
+		if (member == ar0234)
+			return ret;
+
+		ar0234_sync_fail(member, ret);
+		return 0;
+	}
+
+	if (!*first)
+		*first = now;
+	skew = ktime_to_ns(ktime_sub(now, *first));
+	member->sync_stream_on_skew_ns = min_t(s64, skew, S32_MAX);
+
+	return 0;
+}
+
+/*
+ * Stream on a sensor, or arm it when it belongs to a sync group. Once the
+ * last member of the group is armed, all of them are switched on back to
+ * back, the sync-sink slaves first. They are then all waiting for the same
+ * TRIG pulse when the master or free-running members start.
+ *
+ * Each member is switched on under its register lock. Its state lock is not
+ * needed and would deadlock, a member stopping its stream holds it while it
+ * waits for ar0234_devices_lock to disarm. A member that fails to start is
+ * disarmed and reports the error until its stream stops.
+ */
+static int ar0234_sync_stream_on(struct ar0234 *ar0234)
+{
+	u32 group = v4l2_ctrl_g_ctrl(ar0234->sync_group);
+	struct ar0234 *member;
+	ktime_t first = 0;
+	int ret = 0;
+	int err;
+
+	if (!group)
+		return ar0234_stream_on_locked(ar0234);
+
+	mutex_lock(&ar0234_devices_lock);
+
+	ar0234->sync_armed = true;
+
+	list_for_each_entry(member, &ar0234_devices, list) {
+		if (v4l2_ctrl_g_ctrl(member->sync_group) == group &&
+		    !member->sync_armed)
+			goto unlock;
+	}
+
+	/* Slaves first, so none misses the first pulse of the master */
+	list_for_each_entry(member, &ar0234_devices, list) {
+		if (!member->sync_armed ||
+		    v4l2_ctrl_g_ctrl(member->sync_group) != group ||
+		    v4l2_ctrl_g_ctrl(member->trigger_mode) !=
+			    AR0234_TRIGGER_MODE_SLAVE_SYNC)
+			continue;
+
+		err = ar0234_sync_start_member(ar0234, member, group, &first);
+		if (err)
+			ret = err;
+	}
+
+	list_for_each_entry(member, &ar0234_devices, list) {
+		if (!member->sync_armed ||
+		    v4l2_ctrl_g_ctrl(member->sync_group) != group)
+			continue;
+
+		err = ar0234_sync_start_member(ar0234, member, group, &first);
+		if (err)
+			ret = err;
+	}
+
+	dev_dbg(ar0234->dev, "sync group %u started\n", group);
+
+unlock:
+	mutex_unlock(&ar0234_devices_lock);
+
+	return ret;
+}
+
+static void ar0234_sync_disarm(struct ar0234 *ar0234)
+{
+	mutex_lock(&ar0234_devices_lock);
+	ar0234->sync_armed = false;
+	mutex_unlock(&ar0234_devices_lock);
+}
+
+static int ar0234_start_streaming(struct ar0234 *ar0234)
+{
+	struct ar0234_phase_timer timer;
+	struct device *dev = ar0234->dev;
+	int ret;
+
+	ret = pm_runtime_resume_and_get(dev);
+	if (ret < 0)
+		return ret;
+
+	/*
+	 * The reset and register writes below run without the control
+	 * handler lock, so controls don't wait for them. Nothing else touches
+	 * the registers meanwhile: the state lock keeps debugfs and format
+	 * changes out, not streaming the temperature worker and the sync
+	 * group, and init_running the controls.
+	 */
+	mutex_lock(ar0234->ctrl_handler.lock);
+	ar0234->sync_error = 0;
+	ar0234->init_running = true;
+	mutex_unlock(ar0234->ctrl_handler.lock);
+
+	/*
+	 * Full initialization only after power on. Otherwise the sensor is
+	 * still configured and in standby, only the frame format is applied.
+	 */
+	if (ar0234->reset_needed) {
+		ret = ar0234_sensor_init(ar0234);
+		if (ret < 0)
+			goto err_init;
+
+		ar0234->reset_needed = false;
+	}
+
+	/* Apply default values of current frame format */
+	ar0234_phase_begin(ar0234, AR0234_PHASE_MODE, &timer);
+	ret = ar0234_reg_seq_write(ar0234, &ar0234->cur_mode->reg_sequence);
+	if (ret < 0) {
+		dev_err(dev, "%s failed to set frame format\n", __func__);
+		goto err_phase_end;
+	}
+
+	ret = ar0234_set_metadata(ar0234, ar0234->metadata_streaming);
+	if (ret < 0) {
+		dev_err(dev, "%s failed to set embedded data\n", __func__);
+		goto err_phase_end;
+	}
+	ar0234_phase_end(ar0234, AR0234_PHASE_MODE, &timer, ret);
+
+	/* Apply customized values from user */
+	mutex_lock(ar0234->ctrl_handler.lock);
+	ar0234->init_running = false;
+	ar0234_phase_begin(ar0234, AR0234_PHASE_CONTROLS, &timer);
+	ret = __v4l2_ctrl_handler_setup(ar0234->sd.ctrl_handler);
+	ar0234_phase_end(ar0234, AR0234_PHASE_CONTROLS, &timer, ret);
+	mutex_unlock(ar0234->ctrl_handler.lock);
+	if (ret)
+		goto err_reset;
+
+	/* Takes the register locks of the whole sync group */
+	ar0234_phase_begin(ar0234, AR0234_PHASE_STREAM_ON, &timer);
+	ret = ar0234_sync_stream_on(ar0234);
+	ar0234_phase_end(ar0234, AR0234_PHASE_STREAM_ON, &timer, ret);
+	if (ret)
+		goto err_rpm_put;
+
+	return 0;
+
+err_phase_end:
+	ar0234_phase_end(ar0234, AR0234_PHASE_MODE, &timer, ret);
+err_init:
+	mutex_lock(ar0234->ctrl_handler.lock);
+	ar0234->init_running = false;
+	mutex_unlock(ar0234->ctrl_handler.lock);
+err_reset:
+	/* The register cache can no longer be trusted */
+	ar0234->reset_needed = true;
+err_rpm_put:
+	ar0234_sync_disarm(ar0234);
+	pm_runtime_put_autosuspend(dev);
+
+	return ret;
+}
+
+static void ar0234_stop_streaming(struct ar0234 *ar0234)
+{
+	struct device *dev = ar0234->dev;
+	int ret;
+
+	/* Don't let the rest of the sync group start this sensor any more */
+	ar0234_sync_disarm(ar0234);
+
+	mutex_lock(ar0234->ctrl_handler.lock);
+	ret = cci_write(ar0234->regmap, AR0234_REG_RESET, AR0234_RESET_DEFAULT,
+			NULL);
+	mutex_unlock(ar0234->ctrl_handler.lock);
+	if (ret < 0)
+		dev_err(dev, "%s failed to stop streaming\n", __func__);
+
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
+}
+
+static void ar0234_temp_work(struct work_struct *work)
+{
+	struct ar0234 *ar0234 =
+		container_of(to_delayed_work(work), struct ar0234, temp_work);
+	int calib1 = ar0234->temp_calib[0];
+	int calib2 = ar0234->temp_calib[1];
+	u64 val;
+	int ret;
+
+	/* The register lock, see struct ar0234 */
+	mutex_lock(ar0234->ctrl_handler.lock);
+
+	if (!ar0234->streaming)
+		goto unlock;
+
+	ret = cci_read(ar0234->regmap, AR0234_REG_TEMPSENS_DATA, &val, NULL);
+	if (!ret) {
+		int temp = (int)(val & AR0234_TEMPSENS_DATA_MASK) - calib1;
+
+		temp = AR0234_TEMP_CALIB1_MC +
+		       temp * (AR0234_TEMP_CALIB2_MC - AR0234_TEMP_CALIB1_MC) /
+			       (calib2 - calib1);
+		WRITE_ONCE(ar0234->temperature,
+			   clamp(temp, AR0234_TEMP_MIN_MC, AR0234_TEMP_MAX_MC));
+	}
+
+	schedule_delayed_work(&ar0234->temp_work,
+			      msecs_to_jiffies(AR0234_TEMP_POLL_MS));
+
+unlock:
+	mutex_unlock(ar0234->ctrl_handler.lock);
+}
+
+static int ar0234_enable_streams(struct v4l2_subdev *sd,
+				 struct v4l2_subdev_state *state, u32 pad,
+				 u64 streams_mask)
+{
+	struct ar0234 *ar0234 = to_ar0234(sd);
+	int ret;
+
+	if (pad == METADATA_PAD) {
+		mutex_lock(ar0234->ctrl_handler.lock);
+
+		/* Applied by the image stream start unless already running */
+		ret = ar0234->streaming ? ar0234_set_metadata(ar0234, true) : 0;
+		if (!ret)
+			ar0234->metadata_streaming = true;
+
+		mutex_unlock(ar0234->ctrl_handler.lock);
+
+		return ret;
+	}
+
+	ret = ar0234_start_streaming(ar0234);
+	if (ret)
+		return ret;
+
+	/* Controls skip the runtime PM calls from here on */
+	mutex_lock(ar0234->ctrl_handler.lock);
+
+	ar0234->streaming = true;
+
+	/* vflip, hflip and the sync group cannot change during streaming */
+	__v4l2_ctrl_grab(ar0234->vflip, true);
+	__v4l2_ctrl_grab(ar0234->hflip, true);
+	__v4l2_ctrl_grab(ar0234->sync_group, true);
+
+	if (ar0234->temp_calib[0])
+		schedule_delayed_work(&ar0234->temp_work, 0);
+
+	mutex_unlock(ar0234->ctrl_handler.lock);
+
+	if (ar0234->irq) {
+		ar0234->frame_sequence = 0;
+		enable_irq(ar0234->irq);
+	}
+
+	return 0;
+}
+
+static int ar0234_disable_streams(struct v4l2_subdev *sd,
+				  struct v4l2_subdev_state *state, u32 pad,
+				  u64 streams_mask)
+{
+	struct ar0234 *ar0234 = to_ar0234(sd);
+
+	if (pad == METADATA_PAD) {
+		mutex_lock(ar0234->ctrl_handler.lock);
+
+		if (ar0234->streaming)
+			ar0234_set_metadata(ar0234, false);
+
+		ar0234->metadata_streaming = false;
+
+		mutex_unlock(ar0234->ctrl_handler.lock);
+
+		return 0;
+	}
+
+	/* No control may rely on the streaming PM reference once dropped */
+	mutex_lock(ar0234->ctrl_handler.lock);
+
+	ar0234->sync_error = 0;
+
+	/* Latch whatever was queued behind an open group hold */
+	__v4l2_ctrl_s_ctrl(ar0234->group_hold, 0);
+
+	ar0234->streaming = false;
+
+	__v4l2_ctrl_grab(ar0234->vflip, false);
+	__v4l2_ctrl_grab(ar0234->hflip, false);
+	__v4l2_ctrl_grab(ar0234->sync_group, false);
+
+	mutex_unlock(ar0234->ctrl_handler.lock);
+
+	/* Takes the control handler lock, never the state lock */
+	cancel_delayed_work_sync(&ar0234->temp_work);
+
+	if (ar0234->irq)
+		disable_irq(ar0234->irq);
+
+	ar0234_stop_streaming(ar0234);
+
+	return 0;
+}
+
+/*
+ * Legacy receivers only call s_stream, turn on both the embedded data and
+ * the image stream so that they still get the metadata lines.
+ */
+static int ar0234_set_stream(struct v4l2_subdev *sd, int enable)
+{
+	int ret;
+
+	if (!enable) {
+		v4l2_subdev_disable_streams(sd, IMAGE_PAD, BIT(0));
+		v4l2_subdev_disable_streams(sd, METADATA_PAD, BIT(0));
+
+		return 0;
+	}
+
+	ret = v4l2_subdev_enable_streams(sd, METADATA_PAD, BIT(0));
+	if (ret)
+		return ret;
+
+	ret = v4l2_subdev_enable_streams(sd, IMAGE_PAD, BIT(0));
+	if (ret)
+		v4l2_subdev_disable_streams(sd, METADATA_PAD, BIT(0));
+
+	return ret;
+}
+
+/* Power/clock management functions */
+static int ar0234_power_on(struct device *dev)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct v4l2_subdev *sd = i2c_get_clientdata(client);
+	struct ar0234 *ar0234 = to_ar0234(sd);
+	int ret;
+
+	/* Hold the sensor in reset until supplies and clock are stable */
+	gpiod_set_value_cansleep(ar0234->hw_config.gpio_reset, 0);
+
+	ret = regulator_bulk_enable(AR0234_NUM_SUPPLIES,
+				    ar0234->hw_config.supplies);
+	if (ret) {
+		dev_err(dev, "%s: failed to enable regulators\n", __func__);
+		return ret;
+	}
+
+	ret = clk_prepare_enable(ar0234->hw_config.extclk);
+	if (ret) {
+		dev_err(dev, "%s: failed to enable clock\n", __func__);
+		goto reg_off;
+	}
+
+	gpiod_set_value_cansleep(ar0234->hw_config.gpio_reset, 1);
+
+	/*
+	 * Don't sleep through the internal initialization here, the first
+	 * register access waits for whatever is left of it.
+	 */
+	ar0234_set_ready_time(ar0234);
+
+	/* Registers went back to their defaults, the cache did not */
+	ar0234->reset_needed = true;
+	ar0234->hw_reset = !!ar0234->hw_config.gpio_reset;
+	ar0234->powered = true;
+
+	return 0;
+
+reg_off:
+	regulator_bulk_disable(AR0234_NUM_SUPPLIES, ar0234->hw_config.supplies);
+
+	return ret;
+}
+
+static int ar0234_power_off(struct device *dev)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct v4l2_subdev *sd = i2c_get_clientdata(client);
+	struct ar0234 *ar0234 = to_ar0234(sd);
+
+	gpiod_set_value_cansleep(ar0234->hw_config.gpio_reset, 0);
+	regulator_bulk_disable(AR0234_NUM_SUPPLIES, ar0234->hw_config.supplies);
+	clk_disable_unprepare(ar0234->hw_config.extclk);
+
+	ar0234->powered = false;
+
+	return 0;
+}
+
+/*
+ * With standby-idle the sensor is left in software standby while suspended.
+ * Registers keep their values, so the next stream start neither powers up
+ * nor reprograms PLL and common settings.
+ */
+static int ar0234_runtime_suspend(struct device *dev)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct v4l2_subdev *sd = i2c_get_clientdata(client);
+	struct ar0234 *ar0234 = to_ar0234(sd);
+
+	if (ar0234->hw_config.standby_idle)
+		return 0;
+
+	return ar0234_power_off(dev);
+}
+
+static int ar0234_runtime_resume(struct device *dev)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct v4l2_subdev *sd = i2c_get_clientdata(client);
+	struct ar0234 *ar0234 = to_ar0234(sd);
+	struct ar0234_phase_timer timer;
+	int ret;
+
+	if (ar0234->powered)
+		return 0;
+
+	ar0234_phase_begin(ar0234, AR0234_PHASE_POWER_ON, &timer);
+	ret = ar0234_power_on(dev);
+	ar0234_phase_end(ar0234, AR0234_PHASE_POWER_ON, &timer, ret);
+
+	return ret;
+}
+
+/*
+ * Board supplies may drop across system sleep, so a sensor idling in
+ * software standby is powered off as well and fully set up again after
+ * resume.
+ */
+static int ar0234_system_suspend(struct device *dev)
+{
+	struct i2c_client *client = to_i2c_client(dev);
+	struct v4l2_subdev *sd = i2c_get_clientdata(client);
+	struct ar0234 *ar0234 = to_ar0234(sd);
+	int ret;
+
+	ret = pm_runtime_force_suspend(dev);
+	if (ret)
+		return ret;
+
+	if (ar0234->powered)
+		ar0234_power_off(dev);
+
+	ar0234->reset_needed = true;
+
+	return 0;
+}
+
+static int ar0234_system_resume(struct device *dev)
+{
+	return pm_runtime_force_resume(dev);
+}
+
+/* Factory calibration of the temperature sensor, left zero if missing */
+static void ar0234_read_temp_calib(struct ar0234 *ar0234)
+{
+	u64 calib1, calib2;
+	int ret = 0;
+
+	cci_read(ar0234->regmap, AR0234_REG_TEMPSENS_CALIB1, &calib1, &ret);
+	cci_read(ar0234->regmap, AR0234_REG_TEMPSENS_CALIB2, &calib2, &ret);
+
+	/* The sensor gets hotter with rising readings */
+	if (ret < 0 || calib2 <= calib1) {
+		dev_warn(ar0234->dev, "temperature sensor not calibrated\n");
+		return;
+	}
+
+	ar0234->temp_calib[0] = calib1;
+	ar0234->temp_calib[1] = calib2;
+}
+
+/* Verify chip ID */
+static int ar0234_identify_module(struct ar0234 *ar0234)
+{
+	int ret;
+	u64 reg_val;
+
+	ar0234_wait_ready(ar0234);
+
+	ret = cci_read(ar0234->regmap, AR0234_REG_CHIP_ID, &reg_val, NULL);
+	if (ret < 0)
+		return dev_err_probe(ar0234->dev, ret,
+				     "failed to read chip id\n");
+
+	if (reg_val == AR0234_CHIP_ID_MONO)
+		ar0234->monochrome = true;
+	else if (reg_val != AR0234_CHIP_ID)
+		return dev_err_probe(ar0234->dev, -EIO,
+				     "Invalid chip id: 0x%x\n", (u16)reg_val);
+
+	dev_info(ar0234->dev, "Success reading chip id: 0x%x\n", (u16)reg_val);
+
+	ar0234_read_temp_calib(ar0234);
+
+	return ret;
+}
+
+/* FLASH rises at the start of exposure, note when before anything else */
+static irqreturn_t ar0234_frame_sync_irq(int irq, void *data)
+{
+	struct ar0234 *ar0234 = data;
+
+	ar0234->frame_sync_time = ktime_get();
+	ar0234->frame_sync_sequence = ar0234->frame_sequence++;
+
+	return IRQ_WAKE_THREAD;
+}
+
+/*
+ * The event also goes to the notify callback of the bridge, which may sleep.
+ * The line stays masked until it is queued, so the next exposure start
+ * cannot overwrite the values of this one.
+ */
+static irqreturn_t ar0234_frame_sync_thread(int irq, void *data)
+{
+	struct ar0234 *ar0234 = data;
+	ktime_t time = ar0234->frame_sync_time;
+	struct v4l2_event ev = {
+		.type = V4L2_EVENT_FRAME_SYNC,
+		.u.frame_sync.frame_sequence = ar0234->frame_sync_sequence,
+	};
+
+	v4l2_subdev_notify_event(&ar0234->sd, &ev);
+
+	trace_ar0234_frame_sync(ar0234->dev, ev.u.frame_sync.frame_sequence,
+				ktime_to_ns(time),
+				ktime_to_ns(ktime_sub(ktime_get(), time)));
+
+	return IRQ_HANDLED;
+}
+
+static int ar0234_subscribe_event(struct v4l2_subdev *sd, struct v4l2_fh *fh,
+				  struct v4l2_event_subscription *sub)
+{
+	struct ar0234 *ar0234 = to_ar0234(sd);
+
+	if (sub->type != V4L2_EVENT_FRAME_SYNC)
+		return v4l2_ctrl_subdev_subscribe_event(sd, fh, sub);
+
+	/* Only with the FLASH output wired to an interrupt */
+	if (!ar0234->irq)
+		return -EINVAL;
+
+	return v4l2_event_subscribe(fh, sub, AR0234_NUM_FRAME_SYNC_EVENTS,
+				    NULL);
+}
+
+static const struct v4l2_subdev_core_ops ar0234_core_ops = {
+	.subscribe_event = ar0234_subscribe_event,
+	.unsubscribe_event = v4l2_event_subdev_unsubscribe,
+};
+
+static const struct v4l2_subdev_video_ops ar0234_video_ops = {
+	.s_stream = ar0234_set_stream,
+};
+
+static int ar0234_get_frame_desc(struct v4l2_subdev *sd, unsigned int pad,
+				 struct v4l2_mbus_frame_desc *fd)
+{
+	struct ar0234 *ar0234 = to_ar0234(sd);
+	struct v4l2_mbus_frame_desc_entry *entry = &fd->entry[0];
+	const struct v4l2_mbus_framefmt *fmt;
+	struct v4l2_subdev_state *state;
+
+	if (pad >= NUM_PADS)
+		return -EINVAL;
+
+	memset(fd, 0, sizeof(*fd));
+	fd->type = V4L2_MBUS_FRAME_DESC_TYPE_CSI2;
+	fd->num_entries = 1;
+
+	state = v4l2_subdev_lock_and_get_active_state(sd);
+	fmt = v4l2_subdev_state_get_format(state, pad);
+
+	/* Both pads share virtual channel 0, told apart by data type */
+	entry->pixelcode = fmt->code;
+	if (pad == IMAGE_PAD) {
+		entry->bus.csi2.dt = ar0234->pll_config->bit_depth == 8 ?
+					     MIPI_CSI2_DT_RAW8 :
+					     MIPI_CSI2_DT_RAW10;
+	} else {
+		entry->flags = V4L2_MBUS_FRAME_DESC_FL_LEN_MAX;
+		entry->length = fmt->width * fmt->height;
+		entry->bus.csi2.dt = MIPI_CSI2_DT_EMBEDDED_8B;
+	}
+
+	v4l2_subdev_unlock_state(state);
+
+	return 0;
+}
+
+static const struct v4l2_subdev_pad_ops ar0234_pad_ops = {
+	.enum_mbus_code = ar0234_enum_mbus_code,
+	.get_fmt = v4l2_subdev_get_fmt,
+	.set_fmt = ar0234_set_pad_format,
+	.get_selection = ar0234_get_selection,
+	.set_selection = ar0234_set_selection,
+	.enum_frame_size = ar0234_enum_frame_size,
+	.get_frame_desc = ar0234_get_frame_desc,
+	.enable_streams = ar0234_enable_streams,
+	.disable_streams = ar0234_disable_streams,
+};
+
+static const struct v4l2_subdev_ops ar0234_subdev_ops = {
+	.core = &ar0234_core_ops,
+	.video = &ar0234_video_ops,
+	.pad = &ar0234_pad_ops,
+};
+
+static const struct v4l2_subdev_internal_ops ar0234_internal_ops = {
+	.init_state = ar0234_init_state,
+};
+
+/* Initialize control handlers */
+static int ar0234_init_controls(struct ar0234 *ar0234)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&ar0234->sd);
+	struct v4l2_fwnode_device_properties props;
+	struct v4l2_ctrl_config trigger_cfg;
+	struct v4l2_ctrl_config sync_cfg;
+	struct v4l2_ctrl_config flash_cfg;
+	struct v4l2_ctrl_config mode_cfg;
+	struct v4l2_ctrl_config delay_cfg;
+	struct v4l2_ctrl_config exposure_cfg;
+	struct v4l2_ctrl_handler *ctrl_hdlr;
+	unsigned int pixel_rate;
+	int i, ret;
+
+	ctrl_hdlr = &ar0234->ctrl_handler;
+	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 33);
+	if (ret)
+		return ret;
+
+	/* Controls use the handler lock, they never wait on stream start */
+	mutex_init(&ar0234->mutex);
+
+	/*
+	 * By default, PIXEL_RATE is read only. The limits of the current
+	 * mode are setup in the ar0234_set_framing_limits() call below.
+	 */
+	pixel_rate = ar0234_freq_pixclk[ar0234->hw_config.lane_count_id] *
+		     AR0234_PIXELS_PER_CLK;
+	ar0234->pixel_rate = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
+					       V4L2_CID_PIXEL_RATE, 1,
+					       pixel_rate, 1, pixel_rate);
+	if (ar0234->pixel_rate)
+		ar0234->pixel_rate->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+
+	/*
+	 * Create the controls here, but mode specific limits are setup
+	 * in the ar0234_set_framing_limits() call below.
+	 */
+	ar0234->vblank = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
+					   V4L2_CID_VBLANK, 0, 0xFFFF, 1, 0);
+
+	ar0234->hblank = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
+					   V4L2_CID_HBLANK, 0, 0xFFFF, 1, 0);
+
+	ar0234->exposure = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
+					     V4L2_CID_EXPOSURE,
+					     AR0234_EXPOSURE_MIN, 0xFFFF,
+					     AR0234_EXPOSURE_STEP,
+					     AR0234_EXPOSURE_MIN);
+
+	ar0234->again = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
+					  V4L2_CID_ANALOGUE_GAIN,
+					  AR0234_ANA_GAIN_MIN,
+					  AR0234_ANA_GAIN_MAX,
+					  AR0234_ANA_GAIN_STEP,
+					  AR0234_ANA_GAIN_DEFAULT);
+
+	ar0234->dgain = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
+					  V4L2_CID_DIGITAL_GAIN,
+					  AR0234_DGTL_GAIN_MIN,
+					  AR0234_DGTL_GAIN_MAX,
+					  AR0234_DGTL_GAIN_STEP,
+					  AR0234_DGTL_GAIN_DEFAULT);
+
+	/* Defaults from the device tree */
+	flash_cfg = ar0234_ctrl_flash_enable;
+	flash_cfg.def = ar0234->hw_config.flash_enable;
+	ar0234->flash_enable = v4l2_ctrl_new_custom(ctrl_hdlr, &flash_cfg,
+						    NULL);
+	flash_cfg = ar0234_ctrl_flash_delay;
+	flash_cfg.def = ar0234->hw_config.flash_delay;
+	ar0234->flash_delay = v4l2_ctrl_new_custom(ctrl_hdlr, &flash_cfg, NULL);
+	ar0234->flash_polarity =
+		v4l2_ctrl_new_custom(ctrl_hdlr, &ar0234_ctrl_flash_polarity,
+				     NULL);
+	ar0234->exposure_fine =
+		v4l2_ctrl_new_custom(ctrl_hdlr, &ar0234_ctrl_exposure_fine,
+				     NULL);
+
+	/* Exposure, gains, strobe and frame length are latched together */
+	v4l2_ctrl_cluster(8, &ar0234->exposure);
+	v4l2_ctrl_notify(ar0234->vblank, ar0234_vblank_notify, ar0234);
+
+	/* After the controls it sets, so that the handler setup repeats it */
+	exposure_cfg = ar0234_ctrl_exposure_us;
+	exposure_cfg.max = div_u64((u64)AR0234_EXPOSURE_MAX *
+					   AR0234_LINE_LENGTH_PCK_MAX *
+					   USEC_PER_SEC,
+				   ar0234_freq_pixclk[ar0234->hw_config
+							      .lane_count_id]);
+	ar0234->exposure_us = v4l2_ctrl_new_custom(ctrl_hdlr, &exposure_cfg,
+						   NULL);
+
+	/* Batches of clusters are latched together through the group hold */
+	ar0234->group_hold = v4l2_ctrl_new_custom(ctrl_hdlr,
+						  &ar0234_ctrl_group_hold,
+						  NULL);
+
+	for (i = 0; i < ARRAY_SIZE(ar0234_ctrl_delays); i++) {
+		delay_cfg = ar0234_ctrl_delay;
+		delay_cfg.id = ar0234_ctrl_delays[i].id;
+		delay_cfg.name = ar0234_ctrl_delays[i].name;
+		delay_cfg.min = ar0234_ctrl_delays[i].frames;
+		delay_cfg.max = delay_cfg.min;
+		delay_cfg.def = delay_cfg.min;
+		v4l2_ctrl_new_custom(ctrl_hdlr, &delay_cfg, NULL);
+	}
+
+	/* Preloaded before the context is applied by the handler setup */
+	mode_cfg = ar0234_ctrl_context_b_mode;
+	mode_cfg.max = ar0234->num_modes - 1;
+	mode_cfg.qmenu = ar0234->mode_names;
+	ar0234->context_b_mode = v4l2_ctrl_new_custom(ctrl_hdlr, &mode_cfg,
+						      NULL);
+	ar0234->context = v4l2_ctrl_new_custom(ctrl_hdlr, &ar0234_ctrl_context,
+					       NULL);
+
+	/* Device tree setting takes precedence over module parameter */
+	trigger_cfg = ar0234_ctrl_trigger_mode;
+	if (ar0234->hw_config.trigger_mode >= 0)
+		trigger_cfg.def = ar0234->hw_config.trigger_mode;
+	else
+		trigger_cfg.def = trigger_mode;
+	trigger_cfg.def = clamp_t(s64, trigger_cfg.def, 0, trigger_cfg.max);
+	ar0234->trigger_mode = v4l2_ctrl_new_custom(ctrl_hdlr, &trigger_cfg,
+						    NULL);
+	ar0234->trigger_latency =
+		v4l2_ctrl_new_custom(ctrl_hdlr, &ar0234_ctrl_trigger_latency,
+				     NULL);
+	v4l2_ctrl_new_custom(ctrl_hdlr, &ar0234_ctrl_software_trigger, NULL);
+
+	sync_cfg = ar0234_ctrl_sync_group;
+	sync_cfg.def = min_t(u32, ar0234->hw_config.sync_group,
+			     AR0234_SYNC_GROUP_MAX);
+	ar0234->sync_group = v4l2_ctrl_new_custom(ctrl_hdlr, &sync_cfg, NULL);
+	v4l2_ctrl_new_custom(ctrl_hdlr, &ar0234_ctrl_sync_stream_on_skew, NULL);
+
+	if (ar0234->temp_calib[0])
+		v4l2_ctrl_new_custom(ctrl_hdlr, &ar0234_ctrl_temperature, NULL);
+
+	ar0234->hflip = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
+					  V4L2_CID_HFLIP, 0, 1, 1, 0);
+
+	ar0234->vflip = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
+					  V4L2_CID_VFLIP, 0, 1, 1, 0);
+
+	ar0234->test_pattern = v4l2_ctrl_new_std_menu_items(
+		ctrl_hdlr, &ar0234_ctrl_ops, V4L2_CID_TEST_PATTERN,
+		ARRAY_SIZE(ar0234_test_pattern_menu) - 1, 0, 0,
+		ar0234_test_pattern_menu);
+	for (i = 0; i < 4; i++) {
+		/*
+		 * The assumption is that
+		 * V4L2_CID_TEST_PATTERN_GREENR == V4L2_CID_TEST_PATTERN_RED + 1
+		 * V4L2_CID_TEST_PATTERN_BLUE   == V4L2_CID_TEST_PATTERN_RED + 2
+		 * V4L2_CID_TEST_PATTERN_GREENB == V4L2_CID_TEST_PATTERN_RED + 3
+		 */
+		v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
+				  V4L2_CID_TEST_PATTERN_RED + i,
+				  AR0234_TEST_PATTERN_COLOR_MIN,
+				  AR0234_TEST_PATTERN_COLOR_MAX,
+				  AR0234_TEST_PATTERN_COLOR_STEP,
+				  AR0234_TEST_PATTERN_COLOR_MAX);
+		/* The "Solid color" pattern is white by default */
+	}
+
+	/* Selected through the media bus code */
+	ar0234->link_freq =
+		v4l2_ctrl_new_int_menu(ctrl_hdlr, &ar0234_ctrl_ops,
+				       V4L2_CID_LINK_FREQ,
+				       ar0234->num_pll_configs - 1, 0,
+				       ar0234->link_freqs);
+	if (ar0234->link_freq)
+		ar0234->link_freq->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+
+	ret = v4l2_fwnode_device_parse(&client->dev, &props);
+	if (!ret)
+		v4l2_ctrl_new_fwnode_properties(ctrl_hdlr, &ar0234_ctrl_ops,
+						&props);
+
+	if (ctrl_hdlr->error) {
+		ret = ctrl_hdlr->error;
+		dev_err(&client->dev, "%s control init failed (%d)\n", __func__,
+			ret);
+		goto error;
+	}
+
+	ar0234->sd.ctrl_handler = ctrl_hdlr;
+
+	mutex_lock(ctrl_hdlr->lock);
+
+	ar0234_set_framing_limits(ar0234);
+
+	mutex_unlock(ctrl_hdlr->lock);
+
+	return 0;
+
+error:
+	v4l2_ctrl_handler_free(ctrl_hdlr);
+	mutex_destroy(&ar0234->mutex);
+
+	return ret;
+}
+
+static void ar0234_free_controls(struct ar0234 *ar0234)
+{
+	v4l2_ctrl_handler_free(ar0234->sd.ctrl_handler);
+	mutex_destroy(&ar0234->mutex);
+}
+
+/* Built-in configs take precedence over the same ones from firmware */
+static const struct ar0234_pll_config *
+ar0234_get_pll_config(struct ar0234 *ar0234, unsigned long extclk_frequency,
+		      u64 link_frequency)
+{
+	const struct ar0234_pll_config *pll_config;
+	unsigned int i;
+
+	for (i = 0; i < AR0234_NUM_PLL_CONFIGS; i++) {
+		if (ar0234_pll_configs[i].freq_extclk == extclk_frequency &&
+		    ar0234_pll_configs[i].freq_link == link_frequency)
+			return &ar0234_pll_configs[i];
+	}
+
+	for (i = 0; i < ar0234->num_fw_pll_configs; i++) {
+		pll_config = &ar0234->fw_pll_configs[i];
+
+		if (pll_config->freq_extclk == extclk_frequency &&
+		    pll_config->freq_link == link_frequency)
+			return pll_config;
+	}
+
+	return NULL;
+}
+
+/*
+ * PLL dividers for @link_frequency from @extclk_frequency. VCO is
+ * EXTCLK * PLL_MULTIPLIER / PRE_PLL_CLK_DIV, the link runs at
+ * VCO / OP_SYS_CLK_DIV and the pixel clock stays at 90MHz.
+ */
+static int ar0234_solve_pll(unsigned long extclk_frequency, u64 link_frequency,
+			    u16 *pre_pll_clk_div, u16 *pll_multiplier,
+			    u16 *vt_pix_clk_div, u16 *op_sys_clk_div)
+{
+	unsigned int op_sys, n;
+	u32 rem;
+
+	if (!extclk_frequency)
+		return -EINVAL;
+
+	for (op_sys = 1; op_sys <= AR0234_OP_SYS_CLK_DIV_MAX; op_sys *= 2) {
+		u64 vco = link_frequency * op_sys;
+		u64 vt_pix;
+
+		if (vco < AR0234_PLL_VCO_MIN || vco > AR0234_PLL_VCO_MAX)
+			continue;
+
+		vt_pix = div_u64_rem(vco, AR0234_FREQ_VT_PIX_CLK, &rem);
+		if (rem || vt_pix > AR0234_VT_PIX_CLK_DIV_MAX)
+			continue;
+
+		/* Lowest pre-divider first, for the fastest PLL input clock */
+		for (n = 1; n <= AR0234_PRE_PLL_CLK_DIV_MAX; n++) {
+			u64 m;
+
+			if (extclk_frequency / n > AR0234_PLL_IN_MAX)
+				continue;
+			if (extclk_frequency / n < AR0234_PLL_IN_MIN)
+				break;
+
+			m = div_u64_rem(vco * n, extclk_frequency, &rem);
+			if (rem || m < AR0234_PLL_MULTIPLIER_MIN ||
+			    m > AR0234_PLL_MULTIPLIER_MAX)
+				continue;
+
+			*pre_pll_clk_div = n;
+			*pll_multiplier = m;
+			*vt_pix_clk_div = vt_pix;
+			*op_sys_clk_div = op_sys;
+
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * Derive a PLL config for another EXTCLK rate from the built-in one of the
+ * same link frequency. The VT and OP clocks do not change, so the frame
+ * timing and MIPI timing registers of the built-in config still apply, and
+ * only the dividers are replaced.
+ */
+static const struct ar0234_pll_config *
+ar0234_compute_pll_config(struct ar0234 *ar0234,
+			  unsigned long extclk_frequency, u64 link_frequency)
+{
+	const struct ar0234_pll_config *base = NULL;
+	struct ar0234_pll_config *pll_config;
+	struct cci_reg_sequence *regs;
+	u16 pre_div, mult, vt_pix_div, op_sys_div;
+	unsigned int i;
+
+	for (i = 0; i < AR0234_NUM_PLL_CONFIGS; i++) {
+		if (ar0234_pll_configs[i].freq_link == link_frequency)
+			base = &ar0234_pll_configs[i];
+	}
+
+	if (!base || ar0234_solve_pll(extclk_frequency, link_frequency,
+				      &pre_div, &mult, &vt_pix_div,
+				      &op_sys_div))
+		return NULL;
+
+	pll_config = devm_kmemdup(ar0234->dev, base, sizeof(*base),
+				  GFP_KERNEL);
+	regs = devm_kmemdup(ar0234->dev, base->regs_pll.regs,
+			    base->regs_pll.num_regs * sizeof(*regs),
+			    GFP_KERNEL);
+	if (!pll_config || !regs)
+		return NULL;
+
+	for (i = 0; i < base->regs_pll.num_regs; i++) {
+		switch (regs[i].reg) {
+		case AR0234_REG_PRE_PLL_CLK_DIV:
+			regs[i].val = pre_div;
+			break;
+		case AR0234_REG_PLL_MULTIPLIER:
+			regs[i].val = mult;
+			break;
+		case AR0234_REG_VT_SYS_CLK_DIV:
+			regs[i].val = 1;
+			break;
+		case AR0234_REG_VT_PIX_CLK_DIV:
+			regs[i].val = vt_pix_div;
+			break;
+		case AR0234_REG_OP_SYS_CLK_DIV:
+			regs[i].val = op_sys_div;
+			break;
+		case AR0234_REG_OP_PIX_CLK_DIV:
+			regs[i].val = base->bit_depth;
+			break;
+		}
+	}
+
+	pll_config->freq_extclk = extclk_frequency;
+	pll_config->regs_pll.regs = regs;
+
+	dev_dbg(ar0234->dev,
+		"PLL %lu/%llu Hz: N %u, M %u, vt_pix %u, op_sys %u\n",
+		extclk_frequency, link_frequency, pre_div, mult, vt_pix_div,
+		op_sys_div);
+
+	return pll_config;
+}
+
+/* Same constraints as the generated modes, see struct ar0234_mode_desc */
+static bool ar0234_mode_desc_valid(const struct ar0234_mode_desc *desc)
+{
+	unsigned int x_inc = desc->x_inc;
+	unsigned int y_inc = desc->y_inc;
+
+	if (x_inc != 1 && x_inc != 2 && x_inc != 4)
+		return false;
+	if (y_inc != 1 && y_inc != 2 && y_inc != 4)
+		return false;
+	if (desc->bin && (x_inc > 2 || y_inc > 2 || (x_inc == 1 && y_inc == 1)))
+		return false;
+
+	return desc->crop_width >= AR0234_CROP_MIN_WIDTH &&
+	       desc->crop_width <= AR0234_PIXEL_ARRAY_WIDTH &&
+	       desc->crop_height >= AR0234_CROP_MIN_HEIGHT &&
+	       desc->crop_height <= AR0234_PIXEL_ARRAY_HEIGHT &&
+	       !(desc->crop_width % (AR0234_CROP_WIDTH_ALIGN * x_inc)) &&
+	       !(desc->crop_height % (AR0234_CROP_HEIGHT_ALIGN * y_inc));
+}
+
+/*
+ * Frame timing is computed from the built-in pixel clock, so firmware
+ * dividers have to keep the VT clock at EXTCLK * PLL_MULTIPLIER /
+ * (PRE_PLL_CLK_DIV * VT_SYS_CLK_DIV * VT_PIX_CLK_DIV) = 90MHz.
+ */
+static bool ar0234_fw_pll_clk_valid(const struct ar0234_pll_config *pll_config)
+{
+	const struct ar0234_reg_sequence *regs_pll = &pll_config->regs_pll;
+	u64 pre_div = 0, mult = 0, vt_sys_div = 0, vt_pix_div = 0;
+	unsigned int i;
+
+	for (i = 0; i < regs_pll->num_regs; i++) {
+		u64 val = regs_pll->regs[i].val;
+
+		switch (regs_pll->regs[i].reg) {
+		case AR0234_REG_PRE_PLL_CLK_DIV:
+			pre_div = val;
+			break;
+		case AR0234_REG_PLL_MULTIPLIER:
+			mult = val;
+			break;
+		case AR0234_REG_VT_SYS_CLK_DIV:
+			vt_sys_div = val;
+			break;
+		case AR0234_REG_VT_PIX_CLK_DIV:
+			vt_pix_div = val;
+			break;
+		}
+	}
+
+	if (!pre_div || !mult || !vt_sys_div || !vt_pix_div)
+		return false;
+
+	return pll_config->freq_extclk * mult ==
+	       AR0234_FREQ_VT_PIX_CLK * pre_div * vt_sys_div * vt_pix_div;
+}
+
+static int ar0234_parse_fw_pll(struct ar0234 *ar0234,
+			       struct ar0234_pll_config *pll_config,
+			       const u8 **data, const u8 *end)
+{
+	const struct ar0234_fw_pll *fw_pll = (const void *)*data;
+	const struct ar0234_fw_reg *fw_regs;
+	struct cci_reg_sequence *regs;
+	unsigned int num_regs;
+	unsigned int i;
+
+	if (end - *data < sizeof(*fw_pll))
+		return -EINVAL;
+
+	num_regs = le16_to_cpu(fw_pll->num_regs);
+	fw_regs = (const void *)(fw_pll + 1);
+	if (!num_regs || num_regs > AR0234_FW_PLL_REGS_MAX ||
+	    end - (const u8 *)fw_regs < num_regs * sizeof(*fw_regs))
+		return -EINVAL;
+
+	switch (fw_pll->bit_depth) {
+	case 8:
+		pll_config->fmt_codes.bayer = MEDIA_BUS_FMT_SGRBG8_1X8;
+		pll_config->fmt_codes.mono = MEDIA_BUS_FMT_Y8_1X8;
+		break;
+	case 10:
+		pll_config->fmt_codes.bayer = MEDIA_BUS_FMT_SGRBG10_1X10;
+		pll_config->fmt_codes.mono = MEDIA_BUS_FMT_Y10_1X10;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	regs = devm_kcalloc(ar0234->dev, num_regs, sizeof(*regs), GFP_KERNEL);
+	if (!regs)
+		return -ENOMEM;
+
+	for (i = 0; i < num_regs; i++) {
+		u16 addr = le16_to_cpu(fw_regs[i].addr);
+
+		if (addr & 1 || addr > AR0234_REG_ADDRESS_MAX - 1)
+			return -EINVAL;
+
+		regs[i].reg = CCI_REG16(addr);
+		regs[i].val = le16_to_cpu(fw_regs[i].val);
+	}
+
+	pll_config->freq_link = le64_to_cpu(fw_pll->freq_link);
+	pll_config->freq_extclk = le32_to_cpu(fw_pll->freq_extclk);
+	pll_config->bit_depth = fw_pll->bit_depth;
+	pll_config->regs_pll.regs = regs;
+	pll_config->regs_pll.num_regs = num_regs;
+
+	if (!ar0234_fw_pll_clk_valid(pll_config))
+		return -EINVAL;
+
+	*data = (const u8 *)(fw_regs + num_regs);
+
+	return 0;
+}
+
+static int ar0234_parse_firmware(struct ar0234 *ar0234,
+				 const struct firmware *fw)
+{
+	const struct ar0234_fw_header *header = (const void *)fw->data;
+	const u8 *end = fw->data + fw->size;
+	const struct ar0234_fw_mode *fw_modes;
+	struct ar0234_pll_config *pll_configs;
+	struct ar0234_mode_desc *mode_descs;
+	unsigned int num_plls, num_modes;
+	const u8 *data;
+	unsigned int i;
+	int ret;
+
+	if (fw->size < sizeof(*header) ||
+	    le32_to_cpu(header->magic) != AR0234_FW_MAGIC ||
+	    le16_to_cpu(header->version) != AR0234_FW_VERSION)
+		return -EINVAL;
+
+	num_plls = le16_to_cpu(header->num_plls);
+	num_modes = le16_to_cpu(header->num_modes);
+	if (num_plls > AR0234_FW_PLLS_MAX || num_modes > AR0234_FW_MODES_MAX)
+		return -EINVAL;
+
+	pll_configs = devm_kcalloc(ar0234->dev, num_plls, sizeof(*pll_configs),
+				   GFP_KERNEL);
+	mode_descs = devm_kcalloc(ar0234->dev, num_modes, sizeof(*mode_descs),
+				  GFP_KERNEL);
+	if ((num_plls && !pll_configs) || (num_modes && !mode_descs))
+		return -ENOMEM;
+
+	data = (const u8 *)(header + 1);
+	for (i = 0; i < num_plls; i++) {
+		ret = ar0234_parse_fw_pll(ar0234, &pll_configs[i], &data, end);
+		if (ret)
+			return ret;
+	}
+
+	fw_modes = (const void *)data;
+	if (end - data != num_modes * sizeof(*fw_modes))
+		return -EINVAL;
+
+	for (i = 0; i < num_modes; i++) {
+		struct ar0234_mode_desc *desc = &mode_descs[i];
+
+		desc->crop_width = le16_to_cpu(fw_modes[i].crop_width);
+		desc->crop_height = le16_to_cpu(fw_modes[i].crop_height);
+		desc->x_inc = fw_modes[i].x_inc;
+		desc->y_inc = fw_modes[i].y_inc;
+		desc->bin = fw_modes[i].bin;
+
+		if (!ar0234_mode_desc_valid(desc))
+			return -EINVAL;
+	}
+
+	ar0234->fw_pll_configs = pll_configs;
+	ar0234->num_fw_pll_configs = num_plls;
+	ar0234->fw_mode_descs = mode_descs;
+	ar0234->num_fw_mode_descs = num_modes;
+
+	return 0;
+}
+
+/* The firmware is optional, a broken one is ignored */
+static void ar0234_load_firmware(struct ar0234 *ar0234)
+{
+	const struct firmware *fw;
+	int ret;
+
+	if (firmware_request_nowarn(&fw, AR0234_FIRMWARE, ar0234->dev))
+		return;
+
+	ret = ar0234_parse_firmware(ar0234, fw);
+	release_firmware(fw);
+
+	if (ret) {
+		dev_warn(ar0234->dev, "ignoring invalid %s: %d\n",
+			 AR0234_FIRMWARE, ret);
+		return;
+	}
+
+	dev_info(ar0234->dev, "%s: %u PLL configs, %u modes\n",
+		 AR0234_FIRMWARE, ar0234->num_fw_pll_configs,
+		 ar0234->num_fw_mode_descs);
+}
+
+static int ar0234_parse_hw_config(struct ar0234 *ar0234)
+{
+	struct device *dev = ar0234->dev;
+	struct v4l2_fwnode_endpoint ep_cfg = {
+		.bus_type = V4L2_MBUS_CSI2_DPHY,
+	};
+	struct fwnode_handle *endpoint;
+	struct ar0234_hw_config *hw_config = &ar0234->hw_config;
+	unsigned long extclk_frequency;
+	int ret = -EINVAL;
+	unsigned int i, tm;
+
+	for (i = 0; i < AR0234_NUM_SUPPLIES; i++)
+		hw_config->supplies[i].supply = ar0234_supply_names[i];
+
+	ret = devm_regulator_bulk_get(dev, AR0234_NUM_SUPPLIES,
+				      hw_config->supplies);
+	if (ret)
+		return dev_err_probe(dev, ret, "failed to get regulators\n");
+
+	/* Get optional reset pin, the sensor stays in reset until power on */
+	hw_config->gpio_reset =
+		devm_gpiod_get_optional(dev, "reset", GPIOD_OUT_LOW);
+
+	/* Get input clock (extclk) */
+	hw_config->extclk = devm_clk_get(dev, "extclk");
+	if (IS_ERR(hw_config->extclk))
+		return dev_err_probe(dev, PTR_ERR(hw_config->extclk),
+				     "failed to get extclk\n");
+
+	endpoint = fwnode_graph_get_next_endpoint(dev_fwnode(dev), NULL);
+	if (!endpoint)
+		return dev_err_probe(dev, -ENXIO, "endpoint node not found\n");
+
+	ret = v4l2_fwnode_endpoint_alloc_parse(endpoint, &ep_cfg);
+	fwnode_handle_put(endpoint);
+	if (ret)
+		return dev_err_probe(dev, ret, "failed to parse endpoint\n");
+
+	/* Check the number of MIPI CSI2 data lanes */
+	switch (ep_cfg.bus.mipi_csi2.num_data_lanes) {
+	case 2:
+		hw_config->lane_count_id = AR0234_LANE_COUNT_ID_2LANE;
+		break;
+	case 4:
+		hw_config->lane_count_id = AR0234_LANE_COUNT_ID_4LANE;
+		break;
+	default:
+		ret = dev_err_probe(dev, -EINVAL,
+				    "invalid number of CSI2 data lanes %d\n",
+				    ep_cfg.bus.mipi_csi2.num_data_lanes);
+		goto error_out;
+	}
+
+	hw_config->num_data_lanes = ep_cfg.bus.mipi_csi2.num_data_lanes;
+
+	/* Check the link frequency set in device tree */
+	if (!ep_cfg.nr_of_link_frequencies) {
+		ret = dev_err_probe(dev, -EINVAL,
+				    "link-frequency not found in DT\n");
+		goto error_out;
+	}
+
+	extclk_frequency = clk_get_rate(hw_config->extclk);
+	hw_config->extclk_frequency = extclk_frequency;
+
+	/*
+	 * Collect the sensor modes defined for current EXTCLK and the given
+	 * lane rates. The first usable link frequency in DT is the default.
+	 */
+	for (i = 0; i < ep_cfg.nr_of_link_frequencies; i++) {
+		u64 link_frequency = ep_cfg.link_frequencies[i];
+		const struct ar0234_pll_config *pll_config;
+		unsigned int n = ar0234->num_pll_configs;
+		unsigned int j;
+
+		if (n == AR0234_PLL_CONFIGS_MAX)
+			break;
+
+		for (j = 0; j < n; j++) {
+			if (ar0234->link_freqs[j] == link_frequency)
+				break;
+		}
+
+		/* Listed twice */
+		if (j < n)
+			continue;
+
+		pll_config = ar0234_get_pll_config(ar0234, extclk_frequency,
+						   link_frequency);
+		/* Dividers for other EXTCLK rates are computed */
+		if (!pll_config)
+			pll_config = ar0234_compute_pll_config(ar0234,
+							       extclk_frequency,
+							       link_frequency);
+		if (!pll_config)
+			continue;
+
+		ar0234->pll_configs[n] = pll_config;
+		ar0234->link_freqs[n] = pll_config->freq_link;
+		ar0234->num_pll_configs++;
+	}
+
+	if (!ar0234->num_pll_configs) {
+		ret = dev_err_probe(dev, -EINVAL,
+				    "no PLL config for %lu/%llu Hz\n",
+				    extclk_frequency,
+				    ep_cfg.link_frequencies[0]);
+		goto error_out;
+	}
+
+	ar0234->pll_config = ar0234->pll_configs[0];
+
+	ret = of_property_read_u32(dev->of_node, "trigger-mode", &tm);
+	ar0234->hw_config.trigger_mode = (ret == 0) ? tm : -1;
+
+	hw_config->flash_enable = of_property_read_bool(dev->of_node, "flash");
+
+	if (hw_config->flash_enable) {
+		u32 lead = 0, lag = 0;
+
+		of_property_read_u32(dev->of_node, "flash-lead", &lead);
+		of_property_read_u32(dev->of_node, "flash-lag", &lag);
+
+		if (lead)
+			hw_config->flash_delay = -(s8)lead;
+		else if (lag)
+			hw_config->flash_delay = (s8)lag;
+	}
+
+	of_property_read_u32(dev->of_node, "sync-group",
+			     &hw_config->sync_group);
+
+	hw_config->autosuspend_delay_ms = AR0234_AUTOSUSPEND_DELAY_MS;
+	of_property_read_u32(dev->of_node, "autosuspend-delay-ms",
+			     &hw_config->autosuspend_delay_ms);
+
+	hw_config->standby_idle = of_property_read_bool(dev->of_node,
+							"standby-idle");
+
+	dev_info(dev, "extclk: %luHz, link: %lldHz, lanes: %d\n",
+		 extclk_frequency, ar0234->pll_config->freq_link,
+		 hw_config->num_data_lanes);
+	dev_dbg(dev, "trigger_mode: %d, flash: %s%s\n", hw_config->trigger_mode,
+		hw_config->flash_enable ? "enabled" : "disabled",
+		(hw_config->flash_enable && hw_config->flash_delay) ?
+			((hw_config->flash_delay < 0) ? " (lead)" : " (lag)") :
+			"");
+	dev_dbg(dev, "sync group: %u\n", hw_config->sync_group);
+	dev_dbg(dev, "autosuspend: %ums, idle: %s\n",
+		hw_config->autosuspend_delay_ms,
+		hw_config->standby_idle ? "standby" : "power off");
+
+	ret = 0;
+
+error_out:
+	v4l2_fwnode_endpoint_free(&ep_cfg);
+
+	return ret;
+}
+
+/*
+ * Append writes to an init list. A register set again keeps its first
+ * position with the last value, so the order of the vendor sequences is
+ * kept. Volatile ones such as the sequencer ports keep every write in order.
+ */
+static void ar0234_init_seq_add(struct ar0234 *ar0234,
+				struct cci_reg_sequence *regs,
+				unsigned int *num_regs,
+				const struct cci_reg_sequence *add,
+				unsigned int num_add)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < num_add; i++) {
+		if (!regmap_check_range_table(ar0234->regmap,
+					      CCI_REG_ADDR(add[i].reg),
+					      &ar0234_volatile_table)) {
+			for (j = 0; j < *num_regs; j++) {
+				if (regs[j].reg == add[i].reg)
+					break;
+			}
+
+			if (j < *num_regs) {
+				regs[j].val = add[i].val;
+				continue;
+			}
+		}
+
+		regs[(*num_regs)++] = add[i];
+	}
+}
+
+/*
+ * Build the full init register list of every PLL config once, the lane count
+ * is fixed for the device. The frame format is written on its own as crop
+ * based modes are only known at runtime.
+ */
+static int ar0234_build_init_seqs(struct ar0234 *ar0234)
+{
+	struct ar0234_hw_config *hw_config = &ar0234->hw_config;
+	const struct cci_reg_sequence lanes = {
+		AR0234_REG_SERIAL_FORMAT, 0x0200 | hw_config->num_data_lanes
+	};
+	const struct cci_reg_sequence mfr_30ba = {
+		AR0234_REG_MFR_30BA, ar0234_mfr_30ba_init(ar0234)
+	};
+	unsigned int num_pixclk = ARRAY_SIZE(pixclk_45mhz_mfr_settings);
+	unsigned int max_regs;
+	unsigned int i;
+
+	for (i = 0; i < ar0234->num_pll_configs; i++) {
+		const struct ar0234_reg_sequence *pll_regs =
+			&ar0234->pll_configs[i]->regs_pll;
+		struct cci_reg_sequence *regs;
+		unsigned int num_regs = 0;
+
+		/* Lane count and MFR_30BA on top of the tables */
+		max_regs = pll_regs->num_regs + ARRAY_SIZE(common_init) +
+			   num_pixclk + 2;
+		regs = devm_kcalloc(ar0234->dev, max_regs, sizeof(*regs),
+				    GFP_KERNEL);
+		if (!regs)
+			return -ENOMEM;
+
+		ar0234_init_seq_add(ar0234, regs, &num_regs, pll_regs->regs,
+				    pll_regs->num_regs);
+		ar0234_init_seq_add(ar0234, regs, &num_regs, &lanes, 1);
+		ar0234_init_seq_add(ar0234, regs, &num_regs, common_init,
+				    ARRAY_SIZE(common_init));
+
+		/* Recommended settings for the 45MHz pixel clock */
+		if (ar0234_freq_pixclk[hw_config->lane_count_id] ==
+		    AR0234_FREQ_PIXCLK_45MHZ)
+			ar0234_init_seq_add(ar0234, regs, &num_regs,
+					    pixclk_45mhz_mfr_settings,
+					    num_pixclk);
+
+		/*
+		 * Written even when equal to the reset value, analog gain may
+		 * have changed it while the sensor was not reset in between.
+		 */
+		ar0234_init_seq_add(ar0234, regs, &num_regs, &mfr_30ba, 1);
+
+		ar0234->init_seqs[i].regs = regs;
+		ar0234->init_seqs[i].num_regs = num_regs;
+
+		dev_dbg(ar0234->dev, "init list for %lld Hz: %u writes\n",
+			ar0234->pll_configs[i]->freq_link, num_regs);
+	}
+
+	return 0;
+}
+
+static int ar0234_timing_show(struct seq_file *m, void *data)
+{
+	struct ar0234 *ar0234 = m->private;
+	struct ar0234_phase_stats stats[AR0234_NUM_PHASES];
+	unsigned int i;
+
+	spin_lock(&ar0234->stats_lock);
+	memcpy(stats, ar0234->stats, sizeof(stats));
+	spin_unlock(&ar0234->stats_lock);
+
+	seq_printf(m, "%-10s %8s %10s %10s %10s %10s\n", "phase", "count",
+		   "min_us", "avg_us", "max_us", "xfers");
+
+	for (i = 0; i < AR0234_NUM_PHASES; i++) {
+		u64 avg = stats[i].count ?
+				  div64_u64(stats[i].total_ns, stats[i].count) :
+				  0;
+
+		seq_printf(m, "%-10s %8llu %10llu %10llu %10llu %10llu\n",
+			   ar0234_phase_names[i], stats[i].count,
+			   div_u64(stats[i].min_ns, NSEC_PER_USEC),
+			   div_u64(avg, NSEC_PER_USEC),
+			   div_u64(stats[i].max_ns, NSEC_PER_USEC),
+			   stats[i].xfers);
+	}
+
+	return 0;
+}
+
+static int ar0234_timing_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ar0234_timing_show, inode->i_private);
+}
+
+/* Any write clears the statistics */
+static ssize_t ar0234_timing_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct ar0234 *ar0234 = m->private;
+
+	spin_lock(&ar0234->stats_lock);
+	memset(ar0234->stats, 0, sizeof(ar0234->stats));
+	spin_unlock(&ar0234->stats_lock);
+
+	return count;
+}
+
+static const struct file_operations ar0234_timing_fops = {
+	.owner = THIS_MODULE,
+	.open = ar0234_timing_open,
+	.read = seq_read,
+	.write = ar0234_timing_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * Register access from debugfs, serialized against stream start and controls
+ * the same way as the driver's own. A runtime PM reference keeps the sensor
+ * powered meanwhile.
+ */
+static int ar0234_debugfs_lock(struct ar0234 *ar0234)
+{
+	int ret;
+
+	mutex_lock(&ar0234->mutex);
+	mutex_lock(ar0234->ctrl_handler.lock);
+
+	ret = pm_runtime_resume_and_get(ar0234->dev);
+	if (ret < 0) {
+		mutex_unlock(ar0234->ctrl_handler.lock);
+		mutex_unlock(&ar0234->mutex);
+	}
+
+	return ret;
+}
+
+static void ar0234_debugfs_unlock(struct ar0234 *ar0234)
+{
+	pm_runtime_mark_last_busy(ar0234->dev);
+	pm_runtime_put_autosuspend(ar0234->dev);
+
+	mutex_unlock(ar0234->ctrl_handler.lock);
+	mutex_unlock(&ar0234->mutex);
+}
+
+/* Register window in bursts, straight from the sensor */
+static int ar0234_regs_show(struct seq_file *m, void *data)
+{
+	struct ar0234 *ar0234 = m->private;
+	u8 buf[AR0234_DEBUGFS_REGS_MAX * 2];
+	u32 addr = READ_ONCE(ar0234->dbg_reg_addr);
+	u32 count = READ_ONCE(ar0234->dbg_reg_count);
+	unsigned int i, len;
+	int ret = 0;
+
+	if (addr & 1 || !count || count > AR0234_DEBUGFS_REGS_MAX ||
+	    addr + count * 2 - 1 > AR0234_REG_ADDRESS_MAX)
+		return -EINVAL;
+
+	ret = ar0234_debugfs_lock(ar0234);
+	if (ret < 0)
+		return ret;
+
+	regcache_cache_bypass(ar0234->regmap, true);
+	for (i = 0; i < count * 2 && !ret; i += len) {
+		len = min_t(unsigned int, count * 2 - i,
+			    AR0234_BURST_MAX_BYTES);
+		ret = regmap_bulk_read(ar0234->regmap, addr + i, &buf[i], len);
+	}
+	regcache_cache_bypass(ar0234->regmap, false);
+
+	ar0234_debugfs_unlock(ar0234);
+
+	if (ret)
+		return ret;
+
+	for (i = 0; i < count; i++)
+		seq_printf(m, "0x%04x 0x%04x\n", addr + i * 2,
+			   get_unaligned_be16(&buf[i * 2]));
+
+	return 0;
+}
+
+/*
+ * Write one "<addr> <val> [<val>...]" line to consecutive 16-bit registers.
+ * They go through the register cache, which stays in sync with the sensor,
+ * and are applied live unless a sensor init pending anyway replays them.
+ * Volatile registers such as RESET are only applied live, never replayed.
+ */
+static int ar0234_regs_write_line(struct ar0234 *ar0234, char *line)
+{
+	u8 buf[AR0234_DEBUGFS_REGS_MAX * 2];
+	unsigned int num_regs = 0;
+	unsigned int num_patch = 0;
+	unsigned int i, j, len;
+	u32 addr, val;
+	char *tok;
+	int ret;
+
+	tok = strsep(&line, " \t");
+	if (!tok || kstrtou32(tok, 0, &addr) || addr & 1)
+		return -EINVAL;
+
+	while ((tok = strsep(&line, " \t"))) {
+		if (!*tok)
+			continue;
 
-	ctrl_hdlr = &ar0234->ctrl_handler;
-	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 16);
-	if (ret)
+		if (num_regs == AR0234_DEBUGFS_REGS_MAX ||
+		    kstrtou32(tok, 0, &val) || val > U16_MAX)
+			return -EINVAL;
+
+		put_unaligned_be16(val, &buf[num_regs * 2]);
+		num_regs++;
+	}
+
+	if (!num_regs || addr + num_regs * 2 - 1 > AR0234_REG_ADDRESS_MAX)
+		return -EINVAL;
+
+	ret = ar0234_debugfs_lock(ar0234);
+	if (ret < 0)
 		return ret;
 
-	mutex_init(&ar0234->mutex);
-	ctrl_hdlr->lock = &ar0234->mutex;
+	/* Registers already in the patch are updated in place */
+	for (i = 0; i < num_regs; i++) {
+		u32 reg = CCI_REG16(addr + i * 2);
 
-	/* By default, PIXEL_RATE is read only */
-	pixel_rate = ar0234_freq_pixclk[ar0234->hw_config.lane_count_id];
-	ctrl = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
-				 V4L2_CID_PIXEL_RATE, pixel_rate, pixel_rate, 1,
-				 pixel_rate);
-	if (ctrl)
-		ctrl->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+		if (regmap_check_range_table(ar0234->regmap, addr + i * 2,
+					     &ar0234_volatile_table))
+			continue;
 
-	/*
-	 * Create the controls here, but mode specific limits are setup
-	 * in the ar0234_set_framing_limits() call below.
-	 */
-	ar0234->vblank = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
-					   V4L2_CID_VBLANK, 0, 0xFFFF, 1, 0);
+		for (j = 0; j < ar0234->num_reg_patch; j++) {
+			if (ar0234->reg_patch[j].reg == reg)
+				break;
+		}
 
-	ar0234->hblank = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
-					   V4L2_CID_HBLANK, 0, 0xFFFF, 1, 0);
-	if (ar0234->hblank)
-		ar0234->hblank->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+		if (j == ar0234->num_reg_patch)
+			num_patch++;
+	}
 
-	ar0234->exposure = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
-					     V4L2_CID_EXPOSURE,
-					     AR0234_EXPOSURE_MIN, 0xFFFF,
-					     AR0234_EXPOSURE_STEP,
-					     AR0234_EXPOSURE_MIN);
+	if (ar0234->num_reg_patch + num_patch > AR0234_REG_PATCH_MAX) {
+		ret = -ENOSPC;
+		goto unlock;
+	}
 
-	v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops, V4L2_CID_ANALOGUE_GAIN,
-			  AR0234_ANA_GAIN_MIN, AR0234_ANA_GAIN_MAX,
-			  AR0234_ANA_GAIN_STEP, AR0234_ANA_GAIN_DEFAULT);
+	for (i = 0; i < num_regs * 2; i += len) {
+		len = min_t(unsigned int, num_regs * 2 - i,
+			    AR0234_BURST_MAX_BYTES);
 
-	v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops, V4L2_CID_DIGITAL_GAIN,
-			  AR0234_DGTL_GAIN_MIN, AR0234_DGTL_GAIN_MAX,
-			  AR0234_DGTL_GAIN_STEP, AR0234_DGTL_GAIN_DEFAULT);
+		/* The pending init is left to program the others */
+		if (ar0234->reset_needed) {
+			len = 2;
+			if (!regmap_check_range_table(ar0234->regmap, addr + i,
+						      &ar0234_volatile_table))
+				continue;
+		}
 
-	ar0234->hflip = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
-					  V4L2_CID_HFLIP, 0, 1, 1, 0);
+		ret = regmap_bulk_write(ar0234->regmap, addr + i, &buf[i], len);
+		if (ret) {
+			ar0234_cache_drop(ar0234, addr + i, len);
+			goto unlock;
+		}
+	}
 
-	ar0234->vflip = v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
-					  V4L2_CID_VFLIP, 0, 1, 1, 0);
+	for (i = 0; i < num_regs; i++) {
+		struct cci_reg_sequence reg = {
+			.reg = CCI_REG16(addr + i * 2),
+			.val = get_unaligned_be16(&buf[i * 2]),
+		};
 
-	v4l2_ctrl_new_std_menu_items(ctrl_hdlr, &ar0234_ctrl_ops,
-				     V4L2_CID_TEST_PATTERN,
-				     ARRAY_SIZE(ar0234_test_pattern_menu) - 1,
-				     0, 0, ar0234_test_pattern_menu);
-	for (i = 0; i < 4; i++) {
-		/*
-		 * The assumption is that
-		 * V4L2_CID_TEST_PATTERN_GREENR == V4L2_CID_TEST_PATTERN_RED + 1
-		 * V4L2_CID_TEST_PATTERN_BLUE   == V4L2_CID_TEST_PATTERN_RED + 2
-		 * V4L2_CID_TEST_PATTERN_GREENB == V4L2_CID_TEST_PATTERN_RED + 3
-		 */
-		v4l2_ctrl_new_std(ctrl_hdlr, &ar0234_ctrl_ops,
-				  V4L2_CID_TEST_PATTERN_RED + i,
-				  AR0234_TEST_PATTERN_COLOR_MIN,
-				  AR0234_TEST_PATTERN_COLOR_MAX,
-				  AR0234_TEST_PATTERN_COLOR_STEP,
-				  AR0234_TEST_PATTERN_COLOR_MAX);
-		/* The "Solid color" pattern is white by default */
+		if (regmap_check_range_table(ar0234->regmap,
+					     CCI_REG_ADDR(reg.reg),
+					     &ar0234_volatile_table))
+			continue;
+
+		ar0234_init_seq_add(ar0234, ar0234->reg_patch,
+				    &ar0234->num_reg_patch, &reg, 1);
 	}
 
-	ctrl = v4l2_ctrl_new_int_menu(ctrl_hdlr, &ar0234_ctrl_ops,
-				      V4L2_CID_LINK_FREQ, 0, 0,
-				      &ar0234->pll_config->freq_link);
-	if (ctrl)
-		ctrl->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+unlock:
+	ar0234_debugfs_unlock(ar0234);
 
-	ret = v4l2_fwnode_device_parse(&client->dev, &props);
-	if (!ret)
-		v4l2_ctrl_new_fwnode_properties(ctrl_hdlr, &ar0234_ctrl_ops,
-						&props);
+	return ret;
+}
 
-	if (ctrl_hdlr->error) {
-		ret = ctrl_hdlr->error;
-		dev_err(&client->dev, "%s control init failed (%d)\n", __func__,
-			ret);
-		goto error;
+static ssize_t ar0234_regs_write(struct file *file, const char __user *ubuf,
+				 size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct ar0234 *ar0234 = m->private;
+	char *buf, *pos, *line;
+	int ret = 0;
+
+	if (count > PAGE_SIZE)
+		return -EINVAL;
+
+	buf = memdup_user_nul(ubuf, count);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+
+	pos = buf;
+	while (!ret && (line = strsep(&pos, "\n"))) {
+		line = strim(line);
+		if (*line)
+			ret = ar0234_regs_write_line(ar0234, line);
 	}
 
-	ar0234->sd.ctrl_handler = ctrl_hdlr;
+	kfree(buf);
 
-	mutex_lock(&ar0234->mutex);
+	return ret ? ret : count;
+}
 
-	ar0234_set_framing_limits(ar0234);
+static int ar0234_regs_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ar0234_regs_show, inode->i_private);
+}
 
-	mutex_unlock(&ar0234->mutex);
+static const struct file_operations ar0234_regs_fops = {
+	.owner = THIS_MODULE,
+	.open = ar0234_regs_open,
+	.read = seq_read,
+	.write = ar0234_regs_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int ar0234_patch_show(struct seq_file *m, void *data)
+{
+	struct ar0234 *ar0234 = m->private;
+	unsigned int i;
+
+	mutex_lock(ar0234->ctrl_handler.lock);
+
+	for (i = 0; i < ar0234->num_reg_patch; i++)
+		seq_printf(m, "0x%04x 0x%04llx\n",
+			   CCI_REG_ADDR(ar0234->reg_patch[i].reg),
+			   ar0234->reg_patch[i].val);
+
+	mutex_unlock(ar0234->ctrl_handler.lock);
 
 	return 0;
+}
 
-error:
-	v4l2_ctrl_handler_free(ctrl_hdlr);
-	mutex_destroy(&ar0234->mutex);
+static int ar0234_patch_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ar0234_patch_show, inode->i_private);
+}
+
+/* Any write drops the replayed registers, the sensor keeps them until reset */
+static ssize_t ar0234_patch_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct ar0234 *ar0234 = m->private;
+
+	mutex_lock(ar0234->ctrl_handler.lock);
+	ar0234->num_reg_patch = 0;
+	mutex_unlock(ar0234->ctrl_handler.lock);
+
+	return count;
+}
+
+static const struct file_operations ar0234_patch_fops = {
+	.owner = THIS_MODULE,
+	.open = ar0234_patch_open,
+	.read = seq_read,
+	.write = ar0234_patch_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int ar0234_read_frame_count(struct ar0234 *ar0234, u64 *count)
+{
+	int ret;
+
+	mutex_lock(ar0234->ctrl_handler.lock);
+	ret = cci_read(ar0234->regmap, AR0234_REG_FRAME_COUNT, count, NULL);
+	mutex_unlock(ar0234->ctrl_handler.lock);
 
 	return ret;
 }
 
-static void ar0234_free_controls(struct ar0234 *ar0234)
+/* Wait for FRAME_COUNT to move on from @count, and timestamp the change */
+static int ar0234_selftest_wait_frame(struct ar0234 *ar0234, u64 *count,
+				      ktime_t *timestamp)
 {
-	v4l2_ctrl_handler_free(ar0234->sd.ctrl_handler);
-	mutex_destroy(&ar0234->mutex);
+	ktime_t timeout = ktime_add_ms(ktime_get(),
+				       AR0234_SELFTEST_FRAME_TIMEOUT_MS);
+	u64 val;
+	int ret;
+
+	do {
+		ret = ar0234_read_frame_count(ar0234, &val);
+		if (ret)
+			return ret;
+
+		if (val != *count) {
+			*timestamp = ktime_get();
+			*count = val;
+			return 0;
+		}
+
+		usleep_range(500, 1000);
+	} while (ktime_before(ktime_get(), timeout));
+
+	return -ETIMEDOUT;
 }
 
-static int ar0234_parse_hw_config(struct ar0234 *ar0234)
+/*
+ * Cold start the current format at its highest frame rate, then count the
+ * frames the sensor sends out. The sensor counts them itself, so no receiver
+ * needs to be running.
+ */
+static int ar0234_selftest_measure(struct ar0234 *ar0234,
+				   struct ar0234_selftest_result *result)
 {
-	struct device *dev = ar0234->dev;
-	struct v4l2_fwnode_endpoint ep_cfg = {
-		.bus_type = V4L2_MBUS_CSI2_DPHY,
-	};
-	struct fwnode_handle *endpoint;
-	struct ar0234_hw_config *hw_config = &ar0234->hw_config;
-	unsigned long extclk_frequency;
-	int ret = -EINVAL;
-	unsigned int i, tm;
+	const struct ar0234_mode *mode = ar0234->cur_mode;
+	u64 pixel_rate, frame_pixels;
+	u64 xfers, first, count;
+	ktime_t start, end;
+	int ret;
 
-	for (i = 0; i < AR0234_NUM_SUPPLIES; i++)
-		hw_config->supplies[i].supply = ar0234_supply_names[i];
+	pixel_rate = ar0234_freq_pixclk[ar0234->hw_config.lane_count_id];
+	pixel_rate *= ar0234_pixels_per_clk(mode);
 
-	ret = devm_regulator_bulk_get(dev, AR0234_NUM_SUPPLIES,
-				      hw_config->supplies);
-	if (ret)
-		return dev_err_probe(dev, ret, "failed to get regulators\n");
+	mutex_lock(ar0234->ctrl_handler.lock);
 
-	/* Get optional reset pin */
-	hw_config->gpio_reset =
-		devm_gpiod_get_optional(dev, "reset", GPIOD_OUT_HIGH);
+	__v4l2_ctrl_s_ctrl(ar0234->hblank, ar0234->hblank->minimum);
+	__v4l2_ctrl_s_ctrl(ar0234->vblank, ar0234->vblank->minimum);
+	frame_pixels = (u64)(mode->width + ar0234->hblank->val) *
+		       (mode->height + ar0234->vblank->val);
 
-	/* Get input clock (extclk) */
-	hw_config->extclk = devm_clk_get(dev, "extclk");
-	if (IS_ERR(hw_config->extclk))
-		return dev_err_probe(dev, PTR_ERR(hw_config->extclk),
-				     "failed to get extclk\n");
+	/* From sensor reset to stream on every time, for comparable runs */
+	ar0234->reset_needed = true;
 
-	endpoint = fwnode_graph_get_next_endpoint(dev_fwnode(dev), NULL);
-	if (!endpoint)
-		return dev_err_probe(dev, -ENXIO, "endpoint node not found\n");
+	mutex_unlock(ar0234->ctrl_handler.lock);
 
-	ret = v4l2_fwnode_endpoint_alloc_parse(endpoint, &ep_cfg);
-	fwnode_handle_put(endpoint);
+	result->expected_mfps = div64_u64(pixel_rate * 1000, frame_pixels);
+
+	xfers = atomic64_read(&ar0234->xfers);
+	start = ktime_get();
+
+	ret = ar0234_start_streaming(ar0234);
+
+	result->setup_us = ktime_us_delta(ktime_get(), start);
+	result->xfers = atomic64_read(&ar0234->xfers) - xfers;
 	if (ret)
-		return dev_err_probe(dev, ret, "failed to parse endpoint\n");
+		return ret;
 
-	/* Check the number of MIPI CSI2 data lanes */
-	switch (ep_cfg.bus.mipi_csi2.num_data_lanes) {
-	case 2:
-		hw_config->lane_count_id = AR0234_LANE_COUNT_ID_2LANE;
-		break;
-	case 4:
-		hw_config->lane_count_id = AR0234_LANE_COUNT_ID_4LANE;
-		break;
-	default:
-		ret = dev_err_probe(dev, -EINVAL,
-				    "invalid number of CSI2 data lanes %d\n",
-				    ep_cfg.bus.mipi_csi2.num_data_lanes);
-		goto error_out;
+	/* Measure between two frame starts */
+	ret = ar0234_read_frame_count(ar0234, &count);
+	if (!ret)
+		ret = ar0234_selftest_wait_frame(ar0234, &count, &start);
+	first = count;
+	if (!ret) {
+		msleep(AR0234_SELFTEST_MEASURE_MS);
+		ret = ar0234_selftest_wait_frame(ar0234, &count, &end);
 	}
 
-	hw_config->num_data_lanes = ep_cfg.bus.mipi_csi2.num_data_lanes;
+	ar0234_stop_streaming(ar0234);
 
-	/* Check the link frequency set in device tree */
-	if (!ep_cfg.nr_of_link_frequencies) {
-		ret = dev_err_probe(dev, -EINVAL,
-				    "link-frequency not found in DT\n");
-		goto error_out;
-	}
+	if (ret)
+		return ret;
 
-	extclk_frequency = clk_get_rate(hw_config->extclk);
+	/* The counter is 16 bits wide */
+	count = (u16)(count - first);
+	result->measured_mfps = div64_u64(count * NSEC_PER_SEC * 1000,
+					  ktime_to_ns(ktime_sub(end, start)));
 
-	/*
-	 * Check if there exists a sensor mode defined for current EXTCLK
-	 * and given lane rate.
-	 */
-	for (i = 0; i < ARRAY_SIZE(ar0234_pll_configs); i++) {
-		if (ar0234_pll_configs[i].freq_extclk == extclk_frequency &&
-		    ar0234_pll_configs[i].freq_link ==
-			    ep_cfg.link_frequencies[0])
-			break;
-	}
+	return 0;
+}
 
-	if (i == ARRAY_SIZE(ar0234_pll_configs)) {
-		ret = dev_err_probe(dev, -EINVAL,
-				    "no PLL config for %lu/%llu Hz\n",
-				    extclk_frequency,
-				    ep_cfg.link_frequencies[0]);
-		goto error_out;
+/*
+ * Stream the test pattern in every mode and link frequency of the device,
+ * then restore the format and the controls that were changed. The lane
+ * count is fixed by the hardware.
+ */
+static int ar0234_selftest_run(struct ar0234 *ar0234)
+{
+	const struct ar0234_mode *mode = ar0234->cur_mode;
+	unsigned int pll_index, i, j, n = 0;
+	s32 test_pattern, hblank, vblank, exposure, exposure_us, trigger_mode;
+	int ret;
+
+	if (ar0234->streaming || v4l2_ctrl_g_ctrl(ar0234->sync_group))
+		return -EBUSY;
+
+	mutex_lock(ar0234->ctrl_handler.lock);
+	pll_index = ar0234->link_freq->val;
+	test_pattern = ar0234->test_pattern->val;
+	hblank = ar0234->hblank->val;
+	vblank = ar0234->vblank->val;
+	exposure = ar0234->exposure->val;
+	exposure_us = ar0234->exposure_us->val;
+	trigger_mode = ar0234->trigger_mode->val;
+	__v4l2_ctrl_s_ctrl(ar0234->test_pattern, AR0234_SELFTEST_TEST_PATTERN);
+	/* Free running, frames must not wait for TRIG pulses */
+	__v4l2_ctrl_s_ctrl(ar0234->trigger_mode, AR0234_TRIGGER_MODE_OFF);
+	mutex_unlock(ar0234->ctrl_handler.lock);
+
+	for (i = 0; i < ar0234->num_pll_configs; i++) {
+		for (j = 0; j < ar0234->num_modes; j++) {
+			struct ar0234_selftest_result *result =
+				&ar0234->selftest[n++];
+
+			memset(result, 0, sizeof(*result));
+			result->pll_index = i;
+			result->mode_index = j;
+
+			/* A failed switch must not count the previous mode */
+			ret = ar0234_set_active_format(ar0234,
+						       &ar0234->modes[j], i);
+			if (!ret)
+				ret = ar0234_selftest_measure(ar0234, result);
+			result->ret = ret;
+		}
 	}
 
-	ar0234->pll_config = &ar0234_pll_configs[i];
+	ar0234->num_selftest = n;
 
-	ret = of_property_read_u32(dev->of_node, "trigger-mode", &tm);
-	ar0234->hw_config.trigger_mode = (ret == 0) ? tm : -1;
+	ret = ar0234_set_active_format(ar0234, mode, pll_index);
 
-	hw_config->flash_enable = of_property_read_bool(dev->of_node, "flash");
+	mutex_lock(ar0234->ctrl_handler.lock);
+	__v4l2_ctrl_s_ctrl(ar0234->hblank, hblank);
+	__v4l2_ctrl_s_ctrl(ar0234->vblank, vblank);
+	__v4l2_ctrl_s_ctrl(ar0234->exposure, exposure);
+	/* Derives the three above again */
+	if (exposure_us)
+		__v4l2_ctrl_s_ctrl(ar0234->exposure_us, exposure_us);
+	__v4l2_ctrl_s_ctrl(ar0234->test_pattern, test_pattern);
+	__v4l2_ctrl_s_ctrl(ar0234->trigger_mode, trigger_mode);
+	mutex_unlock(ar0234->ctrl_handler.lock);
 
-	if (hw_config->flash_enable) {
-		u32 lead = 0, lag = 0;
+	return ret;
+}
 
-		of_property_read_u32(dev->of_node, "flash-lead", &lead);
-		of_property_read_u32(dev->of_node, "flash-lag", &lag);
+static int ar0234_selftest_show(struct seq_file *m, void *data)
+{
+	struct ar0234 *ar0234 = m->private;
+	unsigned int i;
 
-		if (lead)
-			hw_config->flash_delay = -(s8)lead;
-		else if (lag)
-			hw_config->flash_delay = (s8)lag;
+	mutex_lock(&ar0234->mutex);
+
+	seq_printf(m, "lanes: %u, test pattern: %s\n",
+		   ar0234->hw_config.num_data_lanes,
+		   ar0234_test_pattern_menu[AR0234_SELFTEST_TEST_PATTERN]);
+	seq_printf(m, "%-28s %10s %8s %6s %10s %10s %s\n", "mode", "link_hz",
+		   "setup_us", "xfers", "fps_max", "fps", "result");
+
+	for (i = 0; i < ar0234->num_selftest; i++) {
+		const struct ar0234_selftest_result *r = &ar0234->selftest[i];
+
+		seq_printf(m, "%-28s %10lld %8u %6u %6u.%03u %6u.%03u %d\n",
+			   ar0234->mode_names[r->mode_index],
+			   ar0234->link_freqs[r->pll_index], r->setup_us,
+			   r->xfers, r->expected_mfps / 1000,
+			   r->expected_mfps % 1000, r->measured_mfps / 1000,
+			   r->measured_mfps % 1000, r->ret);
 	}
 
-	dev_info(dev, "extclk: %luHz, link: %lluHz, lanes: %d\n",
-		 extclk_frequency, ep_cfg.link_frequencies[0],
-		 hw_config->num_data_lanes);
-	dev_dbg(dev, "trigger_mode: %d, flash: %s%s\n", hw_config->trigger_mode,
-		hw_config->flash_enable ? "enabled" : "disabled",
-		(hw_config->flash_enable && hw_config->flash_delay) ?
-			((hw_config->flash_delay < 0) ? " (lead)" : " (lag)") :
-			"");
+	mutex_unlock(&ar0234->mutex);
 
-	ret = 0;
+	return 0;
+}
 
-error_out:
-	v4l2_fwnode_endpoint_free(&ep_cfg);
+static int ar0234_selftest_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ar0234_selftest_show, inode->i_private);
+}
 
-	return ret;
+/* Any write runs the self-test, and returns once it is done */
+static ssize_t ar0234_selftest_write(struct file *file, const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct ar0234 *ar0234 = m->private;
+	int ret;
+
+	mutex_lock(&ar0234->mutex);
+	ret = ar0234_selftest_run(ar0234);
+	mutex_unlock(&ar0234->mutex);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations ar0234_selftest_fops = {
+	.owner = THIS_MODULE,
+	.open = ar0234_selftest_open,
+	.read = seq_read,
+	.write = ar0234_selftest_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* Debug interface, nothing depends on it */
+static void ar0234_debugfs_init(struct ar0234 *ar0234)
+{
+	char name[32];
+
+	snprintf(name, sizeof(name), "ar0234-%s", dev_name(ar0234->dev));
+	ar0234->debugfs = debugfs_create_dir(name, NULL);
+
+	debugfs_create_file("timing", 0600, ar0234->debugfs, ar0234,
+			    &ar0234_timing_fops);
+
+	ar0234->dbg_reg_addr = CCI_REG_ADDR(AR0234_REG_CHIP_ID);
+	ar0234->dbg_reg_count = 1;
+	debugfs_create_x32("reg_addr", 0600, ar0234->debugfs,
+			   &ar0234->dbg_reg_addr);
+	debugfs_create_u32("reg_count", 0600, ar0234->debugfs,
+			   &ar0234->dbg_reg_count);
+	debugfs_create_file("regs", 0600, ar0234->debugfs, ar0234,
+			    &ar0234_regs_fops);
+	debugfs_create_file("patch", 0600, ar0234->debugfs, ar0234,
+			    &ar0234_patch_fops);
+
+	ar0234->selftest = devm_kcalloc(ar0234->dev,
+					ar0234->num_modes *
+						ar0234->num_pll_configs,
+					sizeof(*ar0234->selftest), GFP_KERNEL);
+	if (ar0234->selftest)
+		debugfs_create_file("selftest", 0600, ar0234->debugfs, ar0234,
+				    &ar0234_selftest_fops);
 }
 
 static int ar0234_probe(struct i2c_client *client)
@@ -1496,19 +4588,59 @@ static int ar0234_probe(struct i2c_client *client)
 		return -ENOMEM;
 
 	ar0234->dev = &client->dev;
+	INIT_DELAYED_WORK(&ar0234->temp_work, ar0234_temp_work);
+	spin_lock_init(&ar0234->stats_lock);
 
 	v4l2_i2c_subdev_init(&ar0234->sd, client, &ar0234_subdev_ops);
 
+	/* Extra PLL configs and modes, before the DT link rates are matched */
+	ar0234_load_firmware(ar0234);
+
 	/* Check the hardware configuration in device tree */
 	ret = ar0234_parse_hw_config(ar0234);
 	if (ret)
 		return ret;
 
-	ar0234->regmap =
-		devm_cci_regmap_init_i2c(client, AR0234_REG_ADDRESS_BITS);
+	/* Split transfers to the adapter limits, the same way as regmap-i2c */
+	ar0234->regmap_bus = ar0234_regmap_bus;
+	if (client->adapter->quirks) {
+		const struct i2c_adapter_quirks *quirks =
+			client->adapter->quirks;
+
+		if (quirks->max_write_len)
+			ar0234->regmap_bus.max_raw_write =
+				quirks->max_write_len -
+				AR0234_REG_ADDRESS_BITS / BITS_PER_BYTE;
+		ar0234->regmap_bus.max_raw_read = quirks->max_read_len;
+	}
+
+	ar0234->regmap = devm_regmap_init(&client->dev, &ar0234->regmap_bus,
+					  ar0234, &ar0234_regmap_config);
 	if (IS_ERR(ar0234->regmap))
 		return PTR_ERR(ar0234->regmap);
 
+	ret = ar0234_build_init_seqs(ar0234);
+	if (ret)
+		return ret;
+
+	ret = ar0234_build_modes(ar0234);
+	if (ret)
+		return ret;
+
+	/* Optional, edge type from the device tree */
+	if (client->irq > 0) {
+		ret = devm_request_threaded_irq(ar0234->dev, client->irq,
+						ar0234_frame_sync_irq,
+						ar0234_frame_sync_thread,
+						IRQF_ONESHOT | IRQF_NO_AUTOEN,
+						dev_name(ar0234->dev), ar0234);
+		if (ret)
+			return dev_err_probe(ar0234->dev, ret,
+					     "failed to request irq\n");
+
+		ar0234->irq = client->irq;
+	}
+
 	/*
 	 * Enable power management. The driver supports runtime PM, but needs to
 	 * work when runtime PM is disabled in the kernel. To that end, power
@@ -1521,7 +4653,8 @@ static int ar0234_probe(struct i2c_client *client)
 	pm_runtime_set_active(ar0234->dev);
 	pm_runtime_get_noresume(ar0234->dev);
 	pm_runtime_enable(ar0234->dev);
-	pm_runtime_set_autosuspend_delay(ar0234->dev, 1000);
+	pm_runtime_set_autosuspend_delay(
+		ar0234->dev, ar0234->hw_config.autosuspend_delay_ms);
 	pm_runtime_use_autosuspend(ar0234->dev);
 
 	ret = ar0234_identify_module(ar0234);
@@ -1544,8 +4677,8 @@ static int ar0234_probe(struct i2c_client *client)
 		goto error_power_off;
 	usleep_range(100, 110);
 
-	/* Initialize default format */
-	ar0234_set_default_format(ar0234);
+	/* Initialize default mode, the formats live in the subdev state */
+	ar0234->cur_mode = &ar0234->modes[0];
 
 	ret = ar0234_init_controls(ar0234);
 	if (ret)
@@ -1567,11 +4700,23 @@ static int ar0234_probe(struct i2c_client *client)
 		goto error_handler_free;
 	}
 
+	ar0234->sd.state_lock = &ar0234->mutex;
+	ret = v4l2_subdev_init_finalize(&ar0234->sd);
+	if (ret < 0) {
+		dev_err_probe(ar0234->dev, ret, "failed to init subdev\n");
+		goto error_media_entity;
+	}
+
+	/* Available to sync groups from the first stream start on */
+	mutex_lock(&ar0234_devices_lock);
+	list_add_tail(&ar0234->list, &ar0234_devices);
+	mutex_unlock(&ar0234_devices_lock);
+
 	ret = v4l2_async_register_subdev_sensor(&ar0234->sd);
 	if (ret < 0) {
 		dev_err(ar0234->dev,
 			"failed to register sensor sub-device: %d\n", ret);
-		goto error_media_entity;
+		goto error_list_del;
 	}
 
 	/*
@@ -1582,8 +4727,17 @@ static int ar0234_probe(struct i2c_client *client)
 	pm_runtime_mark_last_busy(ar0234->dev);
 	pm_runtime_put_autosuspend(ar0234->dev);
 
+	ar0234_debugfs_init(ar0234);
+
 	return 0;
 
+error_list_del:
+	mutex_lock(&ar0234_devices_lock);
+	list_del(&ar0234->list);
+	mutex_unlock(&ar0234_devices_lock);
+
+	v4l2_subdev_cleanup(&ar0234->sd);
+
 error_media_entity:
 	media_entity_cleanup(&ar0234->sd.entity);
 
@@ -1603,12 +4757,21 @@ static void ar0234_remove(struct i2c_client *client)
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
 	struct ar0234 *ar0234 = to_ar0234(sd);
 
+	debugfs_remove_recursive(ar0234->debugfs);
 	v4l2_async_unregister_subdev(sd);
+	cancel_delayed_work_sync(&ar0234->temp_work);
+
+	mutex_lock(&ar0234_devices_lock);
+	list_del(&ar0234->list);
+	mutex_unlock(&ar0234_devices_lock);
+
+	v4l2_subdev_cleanup(sd);
 	media_entity_cleanup(&sd->entity);
 	ar0234_free_controls(ar0234);
 
 	pm_runtime_disable(&client->dev);
-	if (!pm_runtime_status_suspended(&client->dev))
+	/* Also powers off a sensor idling in software standby */
+	if (ar0234->powered)
 		ar0234_power_off(&client->dev);
 	pm_runtime_set_suspended(&client->dev);
 }
@@ -1619,8 +4782,10 @@ static const struct of_device_id ar0234_dt_ids[] = {
 };
 MODULE_DEVICE_TABLE(of, ar0234_dt_ids);
 
-static DEFINE_RUNTIME_DEV_PM_OPS(ar0234_pm_ops, ar0234_power_off,
-				 ar0234_power_on, NULL);
+static const struct dev_pm_ops ar0234_pm_ops = {
+	SYSTEM_SLEEP_PM_OPS(ar0234_system_suspend, ar0234_system_resume)
+	RUNTIME_PM_OPS(ar0234_runtime_suspend, ar0234_runtime_resume, NULL)
+};
 
 static struct i2c_driver ar0234_i2c_driver = {
 	.driver = {
@@ -1638,3 +4803,4 @@ MODULE_AUTHOR("Dave Stevenson <dave.stevenson@raspberrypi.com>");
 MODULE_AUTHOR("Danius Kalvaitis <danius@kurokesu.com>");
 MODULE_DESCRIPTION("onsemi AR0234 sensor driver");
 MODULE_LICENSE("GPL");
+MODULE_FIRMWARE(AR0234_FIRMWARE);
@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Tracepoints for the onsemi AR0234 driver.
+ *
+ * Copyright (C) 2026, UAB Kurokesu
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ar0234
+
+#if !defined(_AR0234_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _AR0234_TRACE_H
+
+#include <linux/device.h>
+#include <linux/tracepoint.h>
+
+/* Power on, stream start phases and control writes */
+/* clang-format off */
+TRACE_EVENT(ar0234_phase_begin,
+	TP_PROTO(const struct device *dev, const char *phase),
+	TP_ARGS(dev, phase),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__string(phase, phase)
+	),
+	TP_fast_assign(
+		__assign_str(dev);
+		__assign_str(phase);
+	),
+	TP_printk("%s %s", __get_str(dev), __get_str(phase))
+);
+
+TRACE_EVENT(ar0234_phase_end,
+	TP_PROTO(const struct device *dev, const char *phase, u64 duration_ns,
+		 u64 xfers, int ret),
+	TP_ARGS(dev, phase, duration_ns, xfers, ret),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__string(phase, phase)
+		__field(u64, duration_ns)
+		__field(u64, xfers)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__assign_str(dev);
+		__assign_str(phase);
+		__entry->duration_ns = duration_ns;
+		__entry->xfers = xfers;
+		__entry->ret = ret;
+	),
+	TP_printk("%s %s duration=%llu ns xfers=%llu ret=%d", __get_str(dev),
+		  __get_str(phase), __entry->duration_ns, __entry->xfers,
+		  __entry->ret)
+);
+
+TRACE_EVENT(ar0234_ctrl_write,
+	TP_PROTO(const struct device *dev, u32 id, s32 val, u64 duration_ns,
+		 int ret),
+	TP_ARGS(dev, id, val, duration_ns, ret),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u32, id)
+		__field(s32, val)
+		__field(u64, duration_ns)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__assign_str(dev);
+		__entry->id = id;
+		__entry->val = val;
+		__entry->duration_ns = duration_ns;
+		__entry->ret = ret;
+	),
+	TP_printk("%s id=0x%x val=%d duration=%llu ns ret=%d",
+		  __get_str(dev), __entry->id, __entry->val,
+		  __entry->duration_ns, __entry->ret)
+);
+
+/* Exposure start seen on FLASH, and how long the event took to queue */
+TRACE_EVENT(ar0234_frame_sync,
+	TP_PROTO(const struct device *dev, u32 sequence, u64 timestamp_ns,
+		 u64 delay_ns),
+	TP_ARGS(dev, sequence, timestamp_ns, delay_ns),
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u32, sequence)
+		__field(u64, timestamp_ns)
+		__field(u64, delay_ns)
+	),
+	TP_fast_assign(
+		__assign_str(dev);
+		__entry->sequence = sequence;
+		__entry->timestamp_ns = timestamp_ns;
+		__entry->delay_ns = delay_ns;
+	),
+	TP_printk("%s sequence=%u timestamp=%llu ns delay=%llu ns",
+		  __get_str(dev), __entry->sequence, __entry->timestamp_ns,
+		  __entry->delay_ns)
+);
+/* clang-format on */
+
+#endif /* _AR0234_TRACE_H */
+
+/* Found through the module source directory, see the Kbuild flags */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ar0234_trace
+#include <trace/define_trace.h>
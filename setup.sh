@@ -36,6 +36,7 @@ sudo cp "$SCRIPT_DIR/dkms.conf" "$DKMS_SRC/"
 sudo cp "$SCRIPT_DIR/dkms.postinst" "$DKMS_SRC/"
 sudo cp "$SCRIPT_DIR/Makefile" "$DKMS_SRC/"
 sudo cp "$SCRIPT_DIR"/*.c "$DKMS_SRC/"
+sudo cp "$SCRIPT_DIR"/*.h "$DKMS_SRC/"
 sudo cp "$SCRIPT_DIR"/*.dts "$DKMS_SRC/"
 
 echo "DKMS: adding ${PACKAGE_NAME}/${VERSION}"